@@ -0,0 +1,268 @@
+#include "common/geometryPool.h"
+#include "common/init.h"
+#include "common/vao.h"
+#include <algorithm>
+
+// Buffers start out with room for this many vertices and indices, and
+// grow geometrically from there.
+static const unsigned int MinVertexCapacity = 4096;
+static const unsigned int MinIndexCapacity = 3 * 4096;
+
+GeometryPool::GeometryPool(VertexAttribMask attribs) :
+    _attribs(attribs),
+    _stride(Vao::GetStride(attribs)),
+    _vao(0),
+    _vertices(0),
+    _ids(0),
+    _indices(0),
+    _vertexCapacity(0),
+    _indexCapacity(0),
+    _vertexEnd(0),
+    _indexEnd(0),
+    _liveVertices(0),
+    _liveIndices(0)
+{
+}
+
+GeometryPool::~GeometryPool()
+{
+    if (_vao) {
+        GLuint buffers[] = { _vertices, _ids, _indices };
+        glDeleteBuffers(3, buffers);
+        glDeleteVertexArrays(1, &_vao);
+    }
+}
+
+GeometryPool::Handle
+GeometryPool::Alloc(unsigned int vertexCapacity, unsigned int indexCapacity, int id)
+{
+    Handle handle;
+    if (_freeHandles.empty()) {
+        handle = _meshes.size();
+        _meshes.push_back(Mesh());
+    } else {
+        handle = _freeHandles.back();
+        _freeHandles.pop_back();
+    }
+
+    Mesh& mesh = _meshes[handle];
+    mesh.VertexCapacity = vertexCapacity;
+    mesh.IndexCapacity = indexCapacity;
+    mesh.IndexCount = 0;
+    mesh.Id = id;
+    mesh.Live = true;
+    _Place(&mesh);
+    return handle;
+}
+
+// Frees the block, but doesn't shrink the buffers until most of them is
+// dead space, so that freeing meshes one at a time doesn't thrash.
+void
+GeometryPool::Free(Handle handle)
+{
+    Mesh& mesh = _meshes[handle];
+    pezCheck(mesh.Live, "Mesh was freed twice.");
+    mesh.Live = false;
+    _liveVertices -= mesh.VertexCapacity;
+    _liveIndices -= mesh.IndexCapacity;
+    _freeHandles.push_back(handle);
+
+    if (_vertexCapacity > MinVertexCapacity && _liveVertices < _vertexCapacity / 4) {
+        _Repack(std::max(MinVertexCapacity, 2 * _liveVertices),
+                std::max(MinIndexCapacity, 2 * _liveIndices));
+    }
+}
+
+void
+GeometryPool::Resize(Handle handle, unsigned int vertexCapacity, unsigned int indexCapacity)
+{
+    Mesh& mesh = _meshes[handle];
+    pezCheck(mesh.Live, "Resizing a freed mesh.");
+    _liveVertices -= mesh.VertexCapacity;
+    _liveIndices -= mesh.IndexCapacity;
+
+    mesh.VertexCapacity = vertexCapacity;
+    mesh.IndexCapacity = indexCapacity;
+    mesh.IndexCount = 0;
+    mesh.Live = true;
+    _Place(&mesh);
+}
+
+void
+GeometryPool::SetVertices(
+    Handle handle,
+    unsigned int first,
+    unsigned int count,
+    const void* verts)
+{
+    const Mesh& mesh = _meshes[handle];
+    pezCheck(first + count <= mesh.VertexCapacity, "Vertex range is out of bounds.");
+    glBindBuffer(GL_ARRAY_BUFFER, _vertices);
+    glBufferSubData(GL_ARRAY_BUFFER,
+                    _stride * (mesh.FirstVertex + first),
+                    _stride * count,
+                    verts);
+    Vao::frameBytesUploaded += _stride * count;
+}
+
+void
+GeometryPool::SetIndices(Handle handle, unsigned int count, const unsigned int* indices)
+{
+    Mesh& mesh = _meshes[handle];
+    pezCheck(count <= mesh.IndexCapacity, "Index count is out of bounds.");
+    mesh.IndexCount = count;
+    if (count == 0) {
+        return;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _indices);
+    glBufferSubData(GL_COPY_WRITE_BUFFER,
+                    sizeof(unsigned int) * mesh.FirstIndex,
+                    sizeof(unsigned int) * count,
+                    indices);
+    Vao::frameBytesUploaded += sizeof(unsigned int) * count;
+}
+
+void
+GeometryPool::Draw(const std::vector<Handle>& handles)
+{
+    _counts.clear();
+    _offsets.clear();
+    _baseVertices.clear();
+    FOR_EACH(handle, handles) {
+        const Mesh& mesh = _meshes[*handle];
+        if (mesh.IndexCount == 0) {
+            continue;
+        }
+        _counts.push_back(mesh.IndexCount);
+        _offsets.push_back(offset(sizeof(unsigned int) * mesh.FirstIndex));
+        _baseVertices.push_back(mesh.FirstVertex);
+    }
+    if (_counts.empty()) {
+        return;
+    }
+
+    glBindVertexArray(_vao);
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES,
+                                  &_counts[0],
+                                  GL_UNSIGNED_INT,
+                                  &_offsets[0],
+                                  _counts.size(),
+                                  &_baseVertices[0]);
+}
+
+void
+GeometryPool::_Place(Mesh* mesh)
+{
+    if (_vertexEnd + mesh->VertexCapacity > _vertexCapacity ||
+        _indexEnd + mesh->IndexCapacity > _indexCapacity) {
+
+        // The mesh isn't live while we repack, so that it doesn't get
+        // copied; there's nothing worth keeping in it anyway.
+        mesh->Live = false;
+        unsigned int vertices = _liveVertices + mesh->VertexCapacity;
+        unsigned int indices = _liveIndices + mesh->IndexCapacity;
+        _Repack(std::max(MinVertexCapacity, std::max(_vertexCapacity, 2 * vertices)),
+                std::max(MinIndexCapacity, std::max(_indexCapacity, 2 * indices)));
+        mesh->Live = true;
+    }
+
+    mesh->FirstVertex = _vertexEnd;
+    mesh->FirstIndex = _indexEnd;
+    _vertexEnd += mesh->VertexCapacity;
+    _indexEnd += mesh->IndexCapacity;
+    _liveVertices += mesh->VertexCapacity;
+    _liveIndices += mesh->IndexCapacity;
+    _FillIds(*mesh);
+}
+
+void
+GeometryPool::_Repack(unsigned int vertexCapacity, unsigned int indexCapacity)
+{
+    GLuint buffers[3];
+    glGenBuffers(3, buffers);
+    GLuint vertices = buffers[0];
+    GLuint ids = buffers[1];
+    GLuint indices = buffers[2];
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vertices);
+    glBufferData(GL_COPY_WRITE_BUFFER, _stride * vertexCapacity, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ids);
+    glBufferData(GL_COPY_WRITE_BUFFER, sizeof(float) * vertexCapacity, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, indices);
+    glBufferData(GL_COPY_WRITE_BUFFER, sizeof(unsigned int) * indexCapacity, NULL, GL_STATIC_DRAW);
+    Vao::totalBytesBuffered += (_stride + sizeof(float)) * vertexCapacity;
+    Vao::totalBytesBuffered += sizeof(unsigned int) * indexCapacity;
+
+    // Meshes are packed in handle order, which is roughly allocation order.
+    unsigned int vertexEnd = 0;
+    unsigned int indexEnd = 0;
+    FOR_EACH(mesh, _meshes) {
+        if (not mesh->Live) {
+            continue;
+        }
+        if (_vao) {
+            glBindBuffer(GL_COPY_READ_BUFFER, _vertices);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, vertices);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                _stride * mesh->FirstVertex,
+                                _stride * vertexEnd,
+                                _stride * mesh->VertexCapacity);
+            glBindBuffer(GL_COPY_READ_BUFFER, _ids);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, ids);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                sizeof(float) * mesh->FirstVertex,
+                                sizeof(float) * vertexEnd,
+                                sizeof(float) * mesh->VertexCapacity);
+            glBindBuffer(GL_COPY_READ_BUFFER, _indices);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, indices);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                sizeof(unsigned int) * mesh->FirstIndex,
+                                sizeof(unsigned int) * indexEnd,
+                                sizeof(unsigned int) * mesh->IndexCount);
+        }
+        mesh->FirstVertex = vertexEnd;
+        mesh->FirstIndex = indexEnd;
+        vertexEnd += mesh->VertexCapacity;
+        indexEnd += mesh->IndexCapacity;
+    }
+
+    if (_vao) {
+        GLuint old[] = { _vertices, _ids, _indices };
+        glDeleteBuffers(3, old);
+    } else {
+        glGenVertexArrays(1, &_vao);
+    }
+
+    glBindVertexArray(_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vertices);
+    Vao::SetInterleavedPointers(_attribs);
+    glBindBuffer(GL_ARRAY_BUFFER, ids);
+    glVertexAttribPointer(AttrBuildingId, 1, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(AttrBuildingId);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices);
+    pezCheck(glGetError() == GL_NO_ERROR, "Geometry pool setup failed");
+
+    _vertices = vertices;
+    _ids = ids;
+    _indices = indices;
+    _vertexCapacity = vertexCapacity;
+    _indexCapacity = indexCapacity;
+    _vertexEnd = vertexEnd;
+    _indexEnd = indexEnd;
+}
+
+// Ids are stored as floats, which are exact for any reasonable id and
+// read as zero by programs that don't enable the attribute.
+void
+GeometryPool::_FillIds(const Mesh& mesh)
+{
+    if (mesh.VertexCapacity == 0) {
+        return;
+    }
+    _idScratch.assign(mesh.VertexCapacity, float(mesh.Id));
+    glBindBuffer(GL_ARRAY_BUFFER, _ids);
+    glBufferSubData(GL_ARRAY_BUFFER,
+                    sizeof(float) * mesh.FirstVertex,
+                    sizeof(float) * mesh.VertexCapacity,
+                    &_idScratch[0]);
+}
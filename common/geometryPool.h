@@ -0,0 +1,102 @@
+#pragma once
+#include "pez/pez.h"
+#include "common/typedefs.h"
+#include <vector>
+
+// Sub-allocates the vertices and indices of many small meshes from a few
+// large buffers, so that any subset of them can be drawn with a
+// single glMultiDrawElementsBaseVertex.  Vertices are interleaved as in
+// Vao::AddInterleaved.  Indices are relative to the first vertex of their
+// mesh, so meshes can be moved around without rewriting them.  Every
+// vertex also carries the id of its mesh in AttrBuildingId.
+//
+// Space is handed out from the end of the buffers; freed or resized meshes
+// leave holes that are squeezed out when the buffers run out of room or
+// become mostly empty.  Either way the live meshes are copied on the GPU.
+class GeometryPool {
+public:
+    typedef unsigned int Handle;
+
+    GeometryPool(VertexAttribMask attribs);
+    ~GeometryPool();
+
+    VertexAttribMask
+    GetAttribs() const { return _attribs; }
+
+    // Reserves room for a mesh.  The contents are undefined until they're
+    // uploaded, and nothing is drawn until SetIndices is called.
+    Handle
+    Alloc(unsigned int vertexCapacity, unsigned int indexCapacity, int id);
+
+    void
+    Free(Handle mesh);
+
+    // Moves the mesh to a block of the given size.  Its contents are lost.
+    void
+    Resize(Handle mesh, unsigned int vertexCapacity, unsigned int indexCapacity);
+
+    unsigned int
+    GetVertexCapacity(Handle mesh) const { return _meshes[mesh].VertexCapacity; }
+
+    unsigned int
+    GetIndexCapacity(Handle mesh) const { return _meshes[mesh].IndexCapacity; }
+
+    void
+    SetVertices(Handle mesh, unsigned int first, unsigned int count, const void* verts);
+
+    // Replaces the indices of a mesh and sets how many of them get drawn.
+    void
+    SetIndices(Handle mesh, unsigned int count, const unsigned int* indices);
+
+    // Draws the given meshes with one call, using the current program.
+    void
+    Draw(const std::vector<Handle>& meshes);
+
+private:
+    struct Mesh {
+        unsigned int FirstVertex;
+        unsigned int VertexCapacity;
+        unsigned int FirstIndex;
+        unsigned int IndexCapacity;
+        unsigned int IndexCount;
+        int Id;
+        bool Live;
+    };
+
+    // Places the mesh at the end of the buffers, making room if needed.
+    void
+    _Place(Mesh* mesh);
+
+    // Copies the live meshes, packed, into new buffers of the given size.
+    void
+    _Repack(unsigned int vertexCapacity, unsigned int indexCapacity);
+
+    void
+    _FillIds(const Mesh& mesh);
+
+    std::vector<Mesh> _meshes;
+    std::vector<Handle> _freeHandles;
+
+    const VertexAttribMask _attribs;
+    const unsigned int _stride;
+
+    GLuint _vao;
+    GLuint _vertices;
+    GLuint _ids;
+    GLuint _indices;
+    unsigned int _vertexCapacity;
+    unsigned int _indexCapacity;
+    unsigned int _vertexEnd;
+    unsigned int _indexEnd;
+    unsigned int _liveVertices;
+    unsigned int _liveIndices;
+
+    // Scratch space for Draw and _FillIds.
+    std::vector<GLsizei> _counts;
+    std::vector<const GLvoid*> _offsets;
+    std::vector<GLint> _baseVertices;
+    std::vector<float> _idScratch;
+
+    GeometryPool(const GeometryPool&);
+    GeometryPool& operator=(const GeometryPool&);
+};
@@ -116,8 +116,14 @@ void ReadBinaryFile(string filename, Blob* destination)
     ifstream binFile(filename.c_str(), ios::binary);
     vector<char> blob((istreambuf_iterator<char>(binFile)), 
                       (istreambuf_iterator<char>()));
-    destination->resize(blob.size());
-    memcpy(&destination[0], &blob[0], blob.size());
+    destination->assign(blob.begin(), blob.end());
+}
+
+void WriteBinaryFile(string filename, const Blob& source)
+{
+    ofstream binFile(filename.c_str(), ios::binary);
+    binFile.write((const char*) &source[0], source.size());
+    pezCheck(binFile.good(), "Unable to write %s", filename.c_str());
 }
 
 
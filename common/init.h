@@ -15,6 +15,8 @@ enum VertexAttribs {
     AttrTexCoord,
     AttrTetId,
     AttrLength,
+    AttrBuildingId,
+    AttrFacet,
 };
 
 // Bit flags useful for argument passing
@@ -24,6 +26,8 @@ enum VertexAttribFlags {
     AttrTexCoordFlag    = (1 << AttrTexCoord),
     AttrTetIdFlag       = (1 << AttrTetId),
     AttrLengthFlag      = (1 << AttrLength),
+    AttrBuildingIdFlag  = (1 << AttrBuildingId),
+    AttrFacetFlag       = (1 << AttrFacet),
 };
 
 // Byte Counts for attributes
@@ -33,6 +37,8 @@ enum VertexAttribWidths {
     AttrTexCoordWidth   = 8,
     AttrTetIdWidth      = 4,
     AttrLengthWidth     = 4,
+    AttrBuildingIdWidth = 4,
+    AttrFacetWidth      = 12,
 };
 
 // Some helper methods for initializing shaders and vertex buffers
@@ -42,6 +48,7 @@ GLuint InitVao(int componentCount, const FloatList& verts);
 GLuint InitVao(int componentCount, const FloatList& verts, const IndexList& indices);
 
 void ReadBinaryFile(string filename, Blob* destination);
+void WriteBinaryFile(string filename, const Blob& source);
 
 inline
 GLuint CurrentProgram()
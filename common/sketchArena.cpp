@@ -0,0 +1,115 @@
+#include "common/sketchArena.h"
+#include "common/typedefs.h"
+#include "tthread/tinythread.h"
+#include <algorithm>
+
+using namespace sketch;
+using namespace std;
+
+static const size_t BlockSize = 64 * 1024;
+static const size_t Alignment = 16;
+
+// The pool is shared between all scenes; scenes are mostly built on the main
+// thread, but nothing prevents a worker from building one.
+static vector<char*> _pool;
+static tthread::mutex _poolMutex;
+static bool _reuseBlocks = true;
+static size_t _highWaterMark = 0;
+static size_t _reservedBytes = 0;
+
+Arena::Arena() :
+    _offset(0),
+    _bytesUsed(0)
+{
+}
+
+Arena::~Arena()
+{
+    Release();
+}
+
+void*
+Arena::Allocate(size_t bytes)
+{
+    bytes = (bytes + Alignment - 1) & ~(Alignment - 1);
+    if (_blocks.empty() || _offset + bytes > _blocks.back().Size) {
+        _blocks.push_back(_AcquireBlock(bytes));
+        _offset = 0;
+    }
+    void* retval = _blocks.back().Data + _offset;
+    _offset += bytes;
+    _bytesUsed += bytes;
+    return retval;
+}
+
+// Oversized requests get a dedicated block that bypasses the pool.
+Arena::Block
+Arena::_AcquireBlock(size_t minSize)
+{
+    Block block;
+    block.Size = max(minSize, BlockSize);
+    block.Data = 0;
+
+    tthread::lock_guard<tthread::mutex> guard(_poolMutex);
+    _highWaterMark = max(_highWaterMark, _bytesUsed + minSize);
+    if (block.Size == BlockSize && !_pool.empty()) {
+        block.Data = _pool.back();
+        _pool.pop_back();
+    } else {
+        block.Data = new char[block.Size];
+        _reservedBytes += block.Size;
+    }
+    return block;
+}
+
+void
+Arena::Release()
+{
+    tthread::lock_guard<tthread::mutex> guard(_poolMutex);
+    _highWaterMark = max(_highWaterMark, _bytesUsed);
+    FOR_EACH(b, _blocks) {
+        if (_reuseBlocks && b->Size == BlockSize) {
+            _pool.push_back(b->Data);
+        } else {
+            delete[] b->Data;
+            _reservedBytes -= b->Size;
+        }
+    }
+    _blocks.clear();
+    _offset = 0;
+    _bytesUsed = 0;
+}
+
+size_t
+Arena::GetHighWaterMark()
+{
+    return _highWaterMark;
+}
+
+size_t
+Arena::GetReservedBytes()
+{
+    return _reservedBytes;
+}
+
+size_t
+Arena::GetPooledBytes()
+{
+    tthread::lock_guard<tthread::mutex> guard(_poolMutex);
+    return _pool.size() * BlockSize;
+}
+
+void
+Arena::SetBlockReuse(bool enabled)
+{
+    tthread::lock_guard<tthread::mutex> guard(_poolMutex);
+    _reuseBlocks = enabled;
+    if (enabled) {
+        return;
+    }
+    for (size_t i = 0; i < _pool.size(); ++i) {
+        delete[] _pool[i];
+        _reservedBytes -= BlockSize;
+    }
+    _pool.clear();
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace sketch
+{
+    // Bump allocator for the objects owned by a sketch::Scene.  Memory is carved
+    // out of large blocks and is only ever released in bulk, when the scene dies.
+    // Released blocks are kept in a process-wide pool so that the next scene can
+    // pick them up without going back to the general-purpose heap.
+    //
+    // The arena does not run destructors; that's up to the owner.
+    class Arena
+    {
+    public:
+        Arena();
+        ~Arena();
+
+        void* Allocate(size_t bytes);
+
+        template<class T> T*
+        New() { return new (Allocate(sizeof(T))) T(); }
+
+        // Returns all blocks to the pool (or to the heap if reuse is disabled).
+        void Release();
+
+        size_t GetBytesUsed() const { return _bytesUsed; }
+
+        // Largest number of bytes that any single arena has held, measured
+        // whenever an arena grabs a new block or is released.
+        static size_t GetHighWaterMark();
+
+        // Bytes currently held in blocks, whether in use or pooled.
+        static size_t GetReservedBytes();
+
+        // Bytes sitting in the pool waiting to be reused.
+        static size_t GetPooledBytes();
+
+        // Disabling reuse frees the pool immediately.
+        static void SetBlockReuse(bool enabled);
+
+    private:
+        struct Block {
+            char* Data;
+            size_t Size;
+        };
+        typedef std::vector<Block> BlockList;
+
+        Block _AcquireBlock(size_t minSize);
+
+        BlockList _blocks;
+        size_t _offset;
+        size_t _bytesUsed;
+
+        Arena(const Arena&);
+        Arena& operator=(const Arena&);
+    };
+
+    // Growable array whose elements are carved out of an arena in chunks,
+    // so that they never move once created and neighbors share cache lines.
+    // The index of an element is its handle; looking it up is a shift and a
+    // mask.  Elements are destroyed along with the array, but their memory
+    // belongs to the arena, which must outlive it.
+    template<class T>
+    class HandleArray
+    {
+    public:
+        enum { ChunkShift = 8, ChunkSize = 1 << ChunkShift };
+
+        HandleArray() : _size(0) {}
+
+        ~HandleArray()
+        {
+            for (size_t i = 0; i < _size; ++i) {
+                (*this)[i].~T();
+            }
+        }
+
+        // Default-constructs a new element, whose handle is the old size.
+        T* Append(Arena* arena)
+        {
+            if (!(_size & (ChunkSize - 1))) {
+                _chunks.push_back((T*) arena->Allocate(sizeof(T) * ChunkSize));
+            }
+            T* t = new (_chunks.back() + (_size & (ChunkSize - 1))) T();
+            ++_size;
+            return t;
+        }
+
+        T& operator[](size_t i) const { return _chunks[i >> ChunkShift][i & (ChunkSize - 1)]; }
+        size_t size() const { return _size; }
+        bool empty() const { return !_size; }
+
+    private:
+        std::vector<T*> _chunks;
+        size_t _size;
+
+        HandleArray(const HandleArray&);
+        HandleArray& operator=(const HandleArray&);
+    };
+}
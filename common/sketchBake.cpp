@@ -0,0 +1,255 @@
+#include "common/sketchBake.h"
+#include "common/init.h"
+#include "common/sketchPlayback.h"
+#include "common/sketchScene.h"
+#include "common/sketchTess.h"
+#include "common/demoContext.h"
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+
+using namespace sketch;
+using namespace glm;
+using namespace std;
+
+// Vertices are shared between steps in blocks of this many, which is a
+// multiple of three so that every run holds whole triangles.  Smaller
+// blocks share more vertices but make for more runs per step.
+static const size_t BlockSize = 96;
+
+// Vertices are packed to twenty bytes, with every attribute on a four-byte
+// boundary.  Positions are normalized shorts; for a playback a hundred
+// units tall, the error is well under a hundredth of a unit.  Facets and
+// texture coordinates are small whole numbers, so bytes hold them exactly.
+struct PackedVertex
+{
+    short Position[4];
+    signed char Normal[4];
+    unsigned char TexCoord[4];
+    unsigned char Facet[4];
+};
+static const float QuantizationScale = 32767;
+static const float NormalScale = 127;
+
+// Keeps flat playbacks from dividing by zero.
+static const float MinHalfExtent = 0.001f;
+
+// Playback is driven through the same private steps that its Update takes,
+// so the baked steps match what the live playback would have drawn.
+BakedPlayback::BakedPlayback(Playback* playback,
+                             Tessellator* tess,
+                             unsigned int stepsPerCommand) :
+    _previousVertexCount(0),
+    _byteCount(0),
+    _commandDuration(playback->_commandDuration),
+    _currentTween(0),
+    _currentStep(0),
+    _currentTweenStartTime(0),
+    _previousTime(0),
+    _started(false)
+{
+    pezCheck(!playback->_started, "Can't bake a playback that has started.");
+    pezCheck(tess->GetVertexAttribs() == Tessellator::FacetAttribs,
+             "Baked playbacks need a tessellator with facets.");
+    pezCheck(stepsPerCommand > 0, "Baked playbacks need at least one step per command.");
+
+    Playback& p = *playback;
+    while (true) {
+        while (p._IsCurrentCommandDiscrete()) {
+            p._ExecuteCurrentCommand(0);
+            p._NextCommand();
+        }
+
+        Tween tween;
+        tween.FirstStep = _steps.size();
+        if (p._currentCommand >= p._commands.size()) {
+            tween.StepCount = 1;
+            _RecordStep(tess);
+            _tweens.push_back(tween);
+            break;
+        }
+
+        tween.StepCount = stepsPerCommand + 1;
+        for (unsigned int i = 0; i <= stepsPerCommand; ++i) {
+            p._ExecuteCurrentCommand(float(i) / stepsPerCommand);
+            _RecordStep(tess);
+        }
+        p._NextCommand();
+        _tweens.push_back(tween);
+    }
+    p._started = true;
+
+    _Upload();
+}
+
+void
+BakedPlayback::_RecordStep(Tessellator* tess)
+{
+    tess->PullFromScene();
+    tess->_UpdateStream();
+    const FacetVertex* verts = (const FacetVertex*) tess->_GetVertices();
+    size_t vertexCount = tess->_GetVertexCount();
+
+    // Reuse each block that matches the same block of the previous step,
+    // and append the rest.
+    Step step;
+    step.FirstRun = _runFirsts.size();
+    _nextBlockOffsets.clear();
+    for (size_t begin = 0; begin < vertexCount; begin += BlockSize) {
+        size_t count = std::min(BlockSize, vertexCount - begin);
+        size_t block = begin / BlockSize;
+        size_t offset = _vertices.size();
+        if (block < _blockOffsets.size() &&
+            std::min(BlockSize, _previousVertexCount - begin) == count &&
+            !memcmp(&_vertices[_blockOffsets[block]], verts + begin,
+                    sizeof(FacetVertex) * count)) {
+            offset = _blockOffsets[block];
+        } else {
+            _vertices.insert(_vertices.end(), verts + begin, verts + begin + count);
+        }
+        _nextBlockOffsets.push_back(offset);
+
+        if (_runFirsts.size() > step.FirstRun &&
+            size_t(_runFirsts.back() + _runCounts.back()) == offset) {
+            _runCounts.back() += count;
+        } else {
+            _runFirsts.push_back(offset);
+            _runCounts.push_back(count);
+        }
+    }
+    step.RunCount = _runFirsts.size() - step.FirstRun;
+    _blockOffsets.swap(_nextBlockOffsets);
+    _previousVertexCount = vertexCount;
+
+    // Steps that didn't move anything come out with the same runs.
+    if (!_steps.empty()) {
+        const Step& previous = _steps.back();
+        if (previous.RunCount == step.RunCount &&
+            equal(_runFirsts.begin() + step.FirstRun, _runFirsts.end(),
+                  _runFirsts.begin() + previous.FirstRun) &&
+            equal(_runCounts.begin() + step.FirstRun, _runCounts.end(),
+                  _runCounts.begin() + previous.FirstRun)) {
+            _runFirsts.resize(step.FirstRun);
+            _runCounts.resize(step.FirstRun);
+            step = previous;
+        }
+    }
+
+    _steps.push_back(step);
+}
+
+void
+BakedPlayback::_Upload()
+{
+    vec3 lower(0);
+    vec3 upper(0);
+    if (!_vertices.empty()) {
+        lower = upper = _vertices[0].Position;
+    }
+    FOR_EACH(v, _vertices) {
+        lower = glm::min(lower, v->Position);
+        upper = glm::max(upper, v->Position);
+    }
+    _translate = (lower + upper) / 2.0f;
+    _scale = glm::max((upper - lower) / 2.0f, vec3(MinHalfExtent));
+
+    vector<PackedVertex> packed(_vertices.size());
+    for (size_t i = 0; i < packed.size(); ++i) {
+        const FacetVertex& v = _vertices[i];
+        PackedVertex& dest = packed[i];
+        vec3 p = glm::round(QuantizationScale * (v.Position - _translate) / _scale);
+        p = glm::clamp(p, vec3(-QuantizationScale), vec3(QuantizationScale));
+        vec3 n = glm::round(NormalScale * glm::clamp(v.Normal, vec3(-1), vec3(1)));
+        for (int c = 0; c < 3; ++c) {
+            dest.Position[c] = short(p[c]);
+            dest.Normal[c] = (signed char) n[c];
+            dest.Facet[c] = (unsigned char) v.Facet[c];
+        }
+        dest.Position[3] = 0;
+        dest.Normal[3] = 0;
+        dest.Facet[3] = 0;
+        dest.TexCoord[0] = (unsigned char) v.TexCoord.x;
+        dest.TexCoord[1] = (unsigned char) v.TexCoord.y;
+        dest.TexCoord[2] = dest.TexCoord[3] = 0;
+    }
+
+    _vao.Init();
+    glBindVertexArray(_vao.vao);
+
+    GLsizei stride = sizeof(PackedVertex);
+    glGenBuffers(1, &_vao.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, _vao.vbo);
+    glBufferData(GL_ARRAY_BUFFER,
+                 stride * packed.size(),
+                 packed.empty() ? NULL : &packed[0],
+                 GL_STATIC_DRAW);
+    glVertexAttribPointer(AttrPosition, 3, GL_SHORT, GL_TRUE, stride,
+                          (const GLvoid*) offsetof(PackedVertex, Position));
+    glVertexAttribPointer(AttrNormal, 3, GL_BYTE, GL_TRUE, stride,
+                          (const GLvoid*) offsetof(PackedVertex, Normal));
+    glVertexAttribPointer(AttrTexCoord, 2, GL_UNSIGNED_BYTE, GL_FALSE, stride,
+                          (const GLvoid*) offsetof(PackedVertex, TexCoord));
+    glVertexAttribPointer(AttrFacet, 3, GL_UNSIGNED_BYTE, GL_FALSE, stride,
+                          (const GLvoid*) offsetof(PackedVertex, Facet));
+    glEnableVertexAttribArray(AttrPosition);
+    glEnableVertexAttribArray(AttrNormal);
+    glEnableVertexAttribArray(AttrTexCoord);
+    glEnableVertexAttribArray(AttrFacet);
+    _byteCount = stride * packed.size();
+    pezCheck(glGetError() == GL_NO_ERROR, "Baked playback upload failed");
+    Vao::totalBytesBuffered += _byteCount;
+
+    _vao.vertexCount = _vertices.size();
+    _vao.indexCount = 0;
+    FacetVertices().swap(_vertices);
+    IndexList().swap(_blockOffsets);
+    IndexList().swap(_nextBlockOffsets);
+}
+
+void
+BakedPlayback::Update(bool explicitBump, bool bump)
+{
+    float time = DemoContext::totalTime;
+    if (time == _previousTime) {
+        return;
+    }
+    _previousTime = time;
+
+    if (!_started) {
+        if (explicitBump && !bump) {
+            return;
+        }
+        _started = true;
+        _currentTweenStartTime = time;
+        _currentTween = 0;
+    } else if (explicitBump ? bump : (time - _currentTweenStartTime) > _commandDuration) {
+        _currentTween = std::min(_currentTween + 1, unsigned(_tweens.size() - 1));
+        _currentTweenStartTime = time;
+    }
+
+    // Hold the last step once the command duration is up, by which time
+    // the tween has all but settled.
+    const Tween& tween = _tweens[_currentTween];
+    float percentage = (time - _currentTweenStartTime) / _commandDuration;
+    float step = percentage * (tween.StepCount - 1) + 0.5f;
+    _currentStep = tween.FirstStep + std::min(unsigned(step), tween.StepCount - 1);
+}
+
+void
+BakedPlayback::Draw()
+{
+    if (!_started) {
+        return;
+    }
+    const Step& step = _steps[_currentStep];
+    if (!step.RunCount) {
+        return;
+    }
+    glUniform3f(u("Scale"), _scale.x, _scale.y, _scale.z);
+    glUniform3f(u("Translate"), _translate.x, _translate.y, _translate.z);
+    _vao.Bind();
+    glMultiDrawArrays(GL_TRIANGLES,
+                      &_runFirsts[step.FirstRun],
+                      &_runCounts[step.FirstRun],
+                      step.RunCount);
+}
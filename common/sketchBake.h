@@ -0,0 +1,82 @@
+#pragma once
+#include "common/typedefs.h"
+#include "common/vao.h"
+#include "common/sketchTess.h"
+#include <vector>
+
+namespace sketch
+{
+    class Playback;
+
+    // Precomputed sketch::Playback.  Every tweened command is run ahead of
+    // time at a fixed number of steps, recording the tessellator's facet
+    // vertices at each step.  Each step shares whichever blocks of vertices
+    // haven't changed since the previous step, so it's drawn as a short
+    // list of runs with a single glMultiDrawArrays, and playback does no
+    // geometry work on the CPU.  Positions are quantized to shorts within
+    // the bounds of the whole playback; draw them with Sketch.Flat.
+    class BakedPlayback
+    {
+    public:
+
+        // Runs the given playback to the end, so it must not have started
+        // yet.  The tessellator must be the one that the playback was
+        // created with, and must emit facets.
+        BakedPlayback(sketch::Playback* playback,
+                      sketch::Tessellator* tess,
+                      unsigned int stepsPerCommand);
+
+        // Same timing as Playback::Update, minus the work.
+        void SetCommandDuration(float seconds) { _commandDuration = seconds; }
+        void Update(bool explicitBump = false, bool bump = false);
+
+        // Draws the current step, if playback has started.  Sets the Scale
+        // and Translate uniforms of the current program.
+        void Draw();
+
+        // Size of the baked buffers.
+        size_t GetByteCount() const { return _byteCount; }
+
+    private:
+
+        // Runs of vertices that make up the triangles of one step.  Steps
+        // that don't move anything share their runs with the previous step.
+        struct Step
+        {
+            unsigned int FirstRun;
+            unsigned int RunCount;
+        };
+        typedef std::vector<Step> Steps;
+
+        // Steps of one tweened command, from zero to full completion.  The
+        // last tween is the finished playback, and has a single step.
+        struct Tween
+        {
+            unsigned int FirstStep;
+            unsigned int StepCount;
+        };
+        typedef std::vector<Tween> Tweens;
+
+        void _RecordStep(sketch::Tessellator* tess);
+        void _Upload();
+
+        Steps _steps;
+        Tweens _tweens;
+        FacetVertices _vertices;
+        std::vector<GLint> _runFirsts;
+        std::vector<GLsizei> _runCounts;
+        IndexList _blockOffsets;
+        IndexList _nextBlockOffsets;
+        size_t _previousVertexCount;
+        Vao _vao;
+        glm::vec3 _scale;
+        glm::vec3 _translate;
+        size_t _byteCount;
+        float _commandDuration;
+        unsigned int _currentTween;
+        unsigned int _currentStep;
+        float _currentTweenStartTime;
+        float _previousTime;
+        bool _started;
+    };
+}
@@ -3,22 +3,49 @@
 #include "common/sketchPlayback.h"
 #include "common/sketchTess.h"
 #include "common/demoContext.h"
+#include <map>
 
 using namespace sketch;
 using namespace std;
 
+// A checkpoint is taken at every command index that is a multiple of
+// this, the first time that playback reaches it.
+static const unsigned int CheckpointInterval = 16;
+
+typedef map<string, unsigned int> SlotMap;
+
+static unsigned int
+_SlotOf(SlotMap* slots, const Json::Value& handle)
+{
+    return slots->insert(make_pair(handle.asString(), slots->size())).first->second;
+}
+
 Playback::Playback(const Json::Value& history,
                    sketch::Scene* scene,
                    sketch::Tessellator* tess) :
-    _history(&history),
     _scene(scene),
     _commandDuration(0.5),
     _currentCommand(0),
     _currentCommandStartTime(-1),
     _previousTime(0),
+    _started(false),
     _tess(tess)
 {
-    cout << _history->size() << " commands in sketchPlayback.\n";
+    _Compile(history);
+    cout << _commands.size() << " commands in sketchPlayback.\n";
+
+    Checkpoint start;
+    start.Command = 0;
+    start.Snapshot = new SceneSnapshot;
+    _scene->TakeSnapshot(start.Snapshot);
+    _checkpoints.push_back(start);
+}
+
+Playback::~Playback()
+{
+    FOR_EACH(c, _checkpoints) {
+        delete c->Snapshot;
+    }
 }
 
 void
@@ -27,18 +54,100 @@ Playback::SetCommandDuration(float seconds)
     _commandDuration = seconds;
 }
 
-const Json::Value&
-Playback::_GetCurrentCommand() const
+// Parses the whole history up front, so that Update does no string work.
+// Each distinct handle string gets a slot, which is filled in when the
+// command that creates the path is executed.
+void
+Playback::_Compile(const Json::Value& history)
 {
-    return (*_history)[_currentCommand];
+    SlotMap slots;
+    _commands.resize(history.size());
+    for (unsigned int i = 0; i < history.size(); ++i) {
+        const Json::Value& cmd = history[i];
+        Command& c = _commands[i];
+        c.Slot = c.Outer = c.FirstSlot = c.SlotCount = 0;
+        string cmdName = cmd[0u].asString();
+        if (cmdName == "AddRectangle") {
+            c.Type = ADD_RECTANGLE;
+            c.Slot = _SlotOf(&slots, cmd[1u]);
+            c.Width = cmd[2u].asDouble();
+            c.Height = cmd[3u].asDouble();
+            c.Eqn = vec4FromJson(cmd[4u]);
+            c.Offset = vec2FromJson(cmd[5u]);
+        } else if (cmdName == "AddHoleQuad") {
+            c.Type = ADD_HOLE_QUAD;
+            c.Slot = _SlotOf(&slots, cmd[1u]);
+            c.P = vec3FromJson(cmd[2u]);
+            c.U = vec3FromJson(cmd[3u]);
+            c.V = vec3FromJson(cmd[4u]);
+            c.Outer = _SlotOf(&slots, cmd[5u]);
+        } else if (cmdName == "AddQuad") {
+            c.Type = ADD_QUAD;
+            c.Slot = _SlotOf(&slots, cmd[1u]);
+            c.P = vec3FromJson(cmd[2u]);
+            c.U = vec3FromJson(cmd[3u]);
+            c.V = vec3FromJson(cmd[4u]);
+        } else if (cmdName == "AddPolygon") { 
+            c.Type = ADD_POLYGON;
+            c.Slot = _SlotOf(&slots, cmd[1u]);
+            c.Width = cmd[2u].asDouble();
+            c.Eqn = vec4FromJson(cmd[3u]);
+            c.Offset = vec2FromJson(cmd[4u]);
+            c.NumPoints = cmd[5u].asInt();
+        } else if (cmdName == "AddInscribedRectangle") { 
+            c.Type = ADD_INSCRIBED_RECTANGLE;
+            c.Slot = _SlotOf(&slots, cmd[1u]);
+            c.Width = cmd[2u].asDouble();
+            c.Height = cmd[3u].asDouble();
+            c.Outer = _SlotOf(&slots, cmd[4u]);
+            c.Offset = vec2FromJson(cmd[5u]);
+        } else if (cmdName == "AddInscribedPolygon") { 
+            c.Type = ADD_INSCRIBED_POLYGON;
+            c.Slot = _SlotOf(&slots, cmd[1u]);
+            c.Width = cmd[2u].asDouble();
+            c.Outer = _SlotOf(&slots, cmd[3u]);
+            c.Offset = vec2FromJson(cmd[4u]);
+            c.NumPoints = cmd[5u].asInt();
+        } else if (cmdName == "PushPaths") { 
+            c.Type = PUSH_PATHS;
+            c.FirstSlot = _slotLists.size();
+            c.SlotCount = cmd[1u].size();
+            for (unsigned int j = 0; j < c.SlotCount; ++j) {
+                _slotLists.push_back(_SlotOf(&slots, cmd[1u][j]));
+            }
+            c.Delta = cmd[2u].asDouble();
+        } else if (cmdName == "PushPath") { 
+            c.Type = PUSH_PATH;
+            c.Slot = _SlotOf(&slots, cmd[1u]);
+            c.Delta = cmd[2u].asDouble();
+            c.FirstSlot = _slotLists.size();
+            c.SlotCount = cmd[3u].size();
+            for (unsigned int j = 0; j < c.SlotCount; ++j) {
+                _slotLists.push_back(_SlotOf(&slots, cmd[3u][j]));
+            }
+        } else if (cmdName == "ScalePath") { 
+            c.Type = SCALE_PATH;
+        } else {
+            pezFatal("Unknown command: %s", cmdName.c_str());
+        }
+    }
+    _slots.assign(slots.size(), 0);
 }
 
+// Commands that add paths take effect at once, rather than being tweened.
 bool
-Playback::_IsDiscreteCommand(const Json::Value& cmd) const
+Playback::_IsCurrentCommandDiscrete() const
 {
-    string cmdName = cmd[0u].asString();
-    string addPrefix("Add");
-    return !cmdName.compare(0, addPrefix.size(), addPrefix);
+    return _currentCommand < _commands.size() &&
+        _commands[_currentCommand].Type < PUSH_PATHS;
+}
+
+Path*
+Playback::_GetSlot(unsigned int slot) const
+{
+    Path* path = _slots[slot];
+    pezCheck(path != NULL, "Invalid handle in slot %d\n", slot);
+    return path;
 }
 
 void
@@ -53,37 +162,39 @@ Playback::Update(bool explicitBump, bool bump)
     if (!explicitBump) {
 
         // Special case the first command so that it always gets executed.
-        if (_currentCommandStartTime < 0) {
+        if (!_started) {
+            _started = true;
             _currentCommandStartTime = time;
             _currentCommand = 0;
             
         // Bump to the next command if it's time.
-        } else if (_IsDiscreteCommand(_GetCurrentCommand())) {
+        } else if (_IsCurrentCommandDiscrete()) {
             _currentCommandStartTime = time;
-            ++_currentCommand;
+            _NextCommand();
         } else if ((time - _currentCommandStartTime) > _commandDuration) { 
             _ExecuteCurrentCommand(1.0);
             _currentCommandStartTime = time;
-            ++_currentCommand;
+            _NextCommand();
         }
 
     } else {
 
-        if (_currentCommandStartTime < 0) {
+        if (!_started) {
             if (!bump) {
                 return;
             }
+            _started = true;
             _currentCommandStartTime = time;
             _currentCommand = 0;
 
         // Bump to the next command if it's time.
-        } else if (_IsDiscreteCommand(_GetCurrentCommand())) {
+        } else if (_IsCurrentCommandDiscrete()) {
             _currentCommandStartTime = time;
-            ++_currentCommand;
+            _NextCommand();
         } else if (bump) { 
             _ExecuteCurrentCommand(1.0);
             _currentCommandStartTime = time;
-            ++_currentCommand;
+            _NextCommand();
         }
 
     }
@@ -92,129 +203,191 @@ Playback::Update(bool explicitBump, bool bump)
     float percentage = (time - _currentCommandStartTime) / _commandDuration;
     while (true) {
         _ExecuteCurrentCommand(percentage);
-        if (_IsDiscreteCommand(_GetCurrentCommand())) {
-            ++_currentCommand;
+        if (_IsCurrentCommandDiscrete()) {
+            _NextCommand();
         } else {
             break;
         }
     }
 }
 
+void
+Playback::Seek(float time)
+{
+    // Find the command that would be running at the given time.
+    unsigned int command = 0;
+    float startTime = 0;
+    while (command < _commands.size()) {
+        const Command& cmd = _commands[command];
+        bool discrete = cmd.Type < PUSH_PATHS;
+        if (!discrete && time < startTime + _commandDuration) {
+            break;
+        }
+        if (!discrete) {
+            startTime += _commandDuration;
+        }
+        ++command;
+    }
+    float percentage = 0;
+    if (command < _commands.size()) {
+        percentage = std::max(0.0f, time - startTime) / _commandDuration;
+    }
+
+    _ReplayTo(command);
+    _ExecuteCurrentCommand(0);
+    if (percentage > 0) {
+        _ExecuteCurrentCommand(percentage);
+    }
+
+    _started = true;
+    _previousTime = DemoContext::totalTime;
+    _currentCommandStartTime = _previousTime - percentage * _commandDuration;
+}
+
+// Moves past the current command, which has already run to completion,
+// and saves a checkpoint if this is the first visit to a multiple of
+// CheckpointInterval.
+void
+Playback::_NextCommand()
+{
+    ++_currentCommand;
+    if (_currentCommand % CheckpointInterval != 0 ||
+        _currentCommand <= _checkpoints.back().Command ||
+        _currentCommand >= _commands.size()) {
+        return;
+    }
+    Checkpoint checkpoint;
+    checkpoint.Command = _currentCommand;
+    checkpoint.Snapshot = new SceneSnapshot;
+    checkpoint.Slots = _slots;
+    _scene->TakeSnapshot(checkpoint.Snapshot);
+    _checkpoints.push_back(checkpoint);
+}
+
+// Leaves the scene as it was just before the given command started.  When
+// playback is already between the nearest checkpoint and the target, it
+// finishes the current command and keeps going from there; otherwise it
+// starts over from the checkpoint.
+void
+Playback::_ReplayTo(unsigned int command)
+{
+    Checkpoints::const_iterator checkpoint = _checkpoints.begin();
+    while (checkpoint + 1 != _checkpoints.end() && (checkpoint + 1)->Command <= command) {
+        ++checkpoint;
+    }
+
+    if (_started &&
+        _currentCommand >= checkpoint->Command &&
+        _currentCommand < command) {
+        if (!_IsCurrentCommandDiscrete()) {
+            _ExecuteCurrentCommand(1.0);
+        }
+        _NextCommand();
+    } else {
+        _scene->RestoreSnapshot(*checkpoint->Snapshot);
+        _slots = checkpoint->Slots;
+        _currentCommand = checkpoint->Command;
+    }
+
+    while (_currentCommand < command) {
+        _ExecuteCurrentCommand(0);
+        if (!_IsCurrentCommandDiscrete()) {
+            _ExecuteCurrentCommand(1.0);
+        }
+        _NextCommand();
+    }
+}
+
 void
 Playback::_ExecuteCurrentCommand(float percentage)
 {
-    if (_currentCommand >= _history->size()) {
+    if (_currentCommand >= _commands.size()) {
         return;
     }
-    const Json::Value& cmd = _GetCurrentCommand();
-
-    string cmdName = cmd[0u].asString();
-    if (cmdName == "AddRectangle") {
-        string handle = cmd[1u].asString();
-        float width = cmd[2u].asDouble();
-        float height = cmd[3u].asDouble();
-        vec4 eqn = vec4FromJson(cmd[4u]);
-        vec2 offset = vec2FromJson(cmd[5u]);
-        CoplanarPath* path = _scene->AddRectangle(width, height, eqn, offset);
-        _handles[handle] = path;
-    } else if (cmdName == "AddHoleQuad") {
-        string handle = cmd[1u].asString();
+    const Command& cmd = _commands[_currentCommand];
+
+    switch (cmd.Type) {
+    case ADD_RECTANGLE: {
+        _slots[cmd.Slot] = _scene->AddRectangle(cmd.Width, cmd.Height, cmd.Eqn, cmd.Offset);
+        break;
+    }
+    case ADD_HOLE_QUAD: {
         Quad q;
-        q.p = vec3FromJson(cmd[2u]);
-        q.u = vec3FromJson(cmd[3u]);
-        q.v = vec3FromJson(cmd[4u]);
-        Path* outer = _handles[cmd[5u].asString()];
-        pezCheck(outer != NULL, "Invalid handle %s\n", cmd[5u].asString().c_str());
-        CoplanarPath* cop = dynamic_cast<CoplanarPath*>(outer);
-        CoplanarPath* path = _scene->AddHoleQuad(q, cop);
-        _handles[handle] = path;
-    } else if (cmdName == "AddQuad") {
-        string handle = cmd[1u].asString();
+        q.p = cmd.P;
+        q.u = cmd.U;
+        q.v = cmd.V;
+        CoplanarPath* cop = AsCoplanar(_GetSlot(cmd.Outer));
+        _slots[cmd.Slot] = _scene->AddHoleQuad(q, cop);
+        break;
+    }
+    case ADD_QUAD: {
         Quad q;
-        q.p = vec3FromJson(cmd[2u]);
-        q.u = vec3FromJson(cmd[3u]);
-        q.v = vec3FromJson(cmd[4u]);
-        CoplanarPath* path = _scene->AddQuad(q);
-        _handles[handle] = path;
-    } else if (cmdName == "AddPolygon") { 
-        string handle = cmd[1u].asString();
-        float radius = cmd[2u].asDouble();
-        vec4 eqn = vec4FromJson(cmd[3u]);
-        vec2 offset = vec2FromJson(cmd[4u]);
-        int numPoints = cmd[5u].asInt();
-        CoplanarPath* path = _scene->AddPolygon(radius, eqn, offset, numPoints);
-        _handles[handle] = path;
-    } else if (cmdName == "AddInscribedRectangle") { 
-        string handle = cmd[1u].asString();
-        float width = cmd[2u].asDouble();
-        float height = cmd[3u].asDouble();
-        Path* outer = _handles[cmd[4u].asString()];
-        pezCheck(outer != NULL, "Invalid handle %s\n", cmd[4u].asString().c_str());
-        CoplanarPath* cop = dynamic_cast<CoplanarPath*>(outer);
-        vec2 offset = vec2FromJson(cmd[5u]);
-        CoplanarPath* path = _scene->AddInscribedRectangle(width, height, cop, offset);
-        _handles[handle] = path;
-    } else if (cmdName == "AddInscribedPolygon") { 
-        string handle = cmd[1u].asString();
-        float radius = cmd[2u].asDouble();
-        Path* outer = _handles[cmd[3u].asString()];
-        pezCheck(outer != NULL, "Invalid handle %s\n", cmd[3u].asString().c_str());
-        CoplanarPath* cop = dynamic_cast<CoplanarPath*>(outer);
-        vec2 offset = vec2FromJson(cmd[4u]);
-        int numPoints = cmd[5u].asInt();
-        CoplanarPath* path = _scene->AddInscribedPolygon(radius, cop, offset, numPoints);
-        _handles[handle] = path;
-    } else if (cmdName == "PushPaths") { 
-        PathList paths;
-        paths.resize(cmd[1u].size());
-        for (size_t i = 0; i < paths.size(); ++i) {
-            string handle = cmd[1u][i].asString();
-            paths[i] = _handles[handle];
-            pezCheck(paths[i] != NULL, "Invalid handle %s\n", handle.c_str());
+        q.p = cmd.P;
+        q.u = cmd.U;
+        q.v = cmd.V;
+        _slots[cmd.Slot] = _scene->AddQuad(q);
+        break;
+    }
+    case ADD_POLYGON: {
+        _slots[cmd.Slot] = _scene->AddPolygon(cmd.Width, cmd.Eqn, cmd.Offset, cmd.NumPoints);
+        break;
+    }
+    case ADD_INSCRIBED_RECTANGLE: {
+        CoplanarPath* cop = AsCoplanar(_GetSlot(cmd.Outer));
+        _slots[cmd.Slot] = _scene->AddInscribedRectangle(cmd.Width, cmd.Height, cop, cmd.Offset);
+        break;
+    }
+    case ADD_INSCRIBED_POLYGON: {
+        CoplanarPath* cop = AsCoplanar(_GetSlot(cmd.Outer));
+        _slots[cmd.Slot] = _scene->AddInscribedPolygon(cmd.Width, cop, cmd.Offset, cmd.NumPoints);
+        break;
+    }
+    case PUSH_PATHS: {
+        _paths.resize(cmd.SlotCount);
+        for (size_t i = 0; i < _paths.size(); ++i) {
+            _paths[i] = _GetSlot(_slotLists[cmd.FirstSlot + i]);
         }
-        float delta = cmd[2u].asDouble();
         if (percentage == 0) {
             _originalPlanes.clear();
-            FOR_EACH(p, paths) {
-                CoplanarPath* cop = dynamic_cast<CoplanarPath*>(*p);
+            FOR_EACH(p, _paths) {
+                CoplanarPath* cop = AsCoplanar(*p);
                 _originalPlanes.push_back(cop->Plane->Eqn.w);
             }
-            _scene->PushPaths(paths, delta);
+            _scene->PushPaths(_paths, cmd.Delta);
             _tess->PullFromScene();
-            _scene->SetPathPlanes(paths, _originalPlanes);
+            _scene->SetPathPlanes(_paths, _originalPlanes);
         } else {
-            FloatList newPlanes;
-            delta = _Tween(delta, percentage);
+            float delta = _Tween(cmd.Delta, percentage);
+            _newPlanes.clear();
             FOR_EACH(p, _originalPlanes) {
-                newPlanes.push_back(*p + delta);
+                _newPlanes.push_back(*p + delta);
             }
-            _scene->SetPathPlanes(paths, newPlanes);
+            _scene->SetPathPlanes(_paths, _newPlanes);
 
         }
-    } else if (cmdName == "PushPath") { 
-        string handle = cmd[1u].asString();
-        Path* path = _handles[handle];
-        pezCheck(path != NULL, "Invalid handle %s\n", handle.c_str());
-        CoplanarPath* cop = dynamic_cast<CoplanarPath*>(path);
-        float delta = cmd[2u].asDouble();
-        PathList walls;
+        break;
+    }
+    case PUSH_PATH: {
+        CoplanarPath* cop = AsCoplanar(_GetSlot(cmd.Slot));
         if (percentage == 0) {
             _originalPlanes.clear();
             _originalPlanes.push_back( cop->Plane->Eqn.w );
-            _scene->PushPath(cop, delta, &walls);
+            _scene->PushPath(cop, cmd.Delta, &_walls);
             _tess->PullFromScene();
             _scene->SetPathPlane(cop, _originalPlanes.front());
-            for (size_t i = 0; i < walls.size(); ++i) {
-                _handles[cmd[3u][i].asString()] = walls[i];
+            for (size_t i = 0; i < _walls.size() && i < cmd.SlotCount; ++i) {
+                _slots[_slotLists[cmd.FirstSlot + i]] = _walls[i];
             }
         } else {
-            delta = _Tween(delta, percentage);
+            float delta = _Tween(cmd.Delta, percentage);
             _scene->SetPathPlane(cop, _originalPlanes.front() + delta);
         }
-    } else if (cmdName == "ScalePath") { 
+        break;
+    }
+    case SCALE_PATH: {
         // TBD
-    } else {
-        pezFatal("Unknown command: %s", cmdName.c_str());
+        break;
+    }
     }
 }
 
@@ -3,14 +3,16 @@
 #include "common/typedefs.h"
 #include "tween/CppTweener.h"
 #include <string>
-#include <map>
+#include <vector>
 
 namespace sketch
 {
     struct Path;
-    typedef std::map<std::string, sketch::Path*> PathHandles;
+    typedef std::vector<sketch::Path*> PathList;
     class Tessellator;
     class Scene;
+    class BakedPlayback;
+    struct SceneSnapshot;
 
     class Playback
     {
@@ -20,21 +22,85 @@ namespace sketch
                  sketch::Tessellator* tess);
         void SetCommandDuration(float seconds);
         void Update(bool explicitBump = false, bool bump = false);
+
+        // Jumps to where playback would be the given number of seconds
+        // after it started, if every tweened command took exactly the
+        // command duration, then carries on from there at the next
+        // Update.  The scene is restored from the nearest checkpoint at
+        // or before that point and replayed from there, instead of from
+        // the first command.
+        void Seek(float time);
+
+        ~Playback();
     private:
+
+        // Discrete commands come first, see _IsCurrentCommandDiscrete.
+        enum CommandType {
+            ADD_RECTANGLE,
+            ADD_HOLE_QUAD,
+            ADD_QUAD,
+            ADD_POLYGON,
+            ADD_INSCRIBED_RECTANGLE,
+            ADD_INSCRIBED_POLYGON,
+            PUSH_PATHS,
+            PUSH_PATH,
+            SCALE_PATH,
+        };
+
+        // History entry with its arguments parsed, and its path handles
+        // replaced by indices into _slots.  Each command only uses the
+        // fields that its Scene method takes.
+        struct Command
+        {
+            CommandType Type;
+            unsigned int Slot;        // path that gets created or pushed
+            unsigned int Outer;       // path that an inscribed path goes in
+            float Width;              // or the radius of polygons
+            float Height;
+            float Delta;
+            int NumPoints;
+            glm::vec4 Eqn;
+            glm::vec2 Offset;
+            glm::vec3 P, U, V;        // quads
+            unsigned int FirstSlot;   // into _slotLists: paths of PushPaths,
+            unsigned int SlotCount;   // or the walls made by PushPath
+        };
+        typedef std::vector<Command> Commands;
+
+        // Scene and handles as they were just before a command started.
+        struct Checkpoint
+        {
+            unsigned int Command;
+            sketch::SceneSnapshot* Snapshot;
+            PathList Slots;
+        };
+        typedef std::vector<Checkpoint> Checkpoints;
+
+        void _Compile(const Json::Value& history);
+        void _NextCommand();
+        void _ReplayTo(unsigned int command);
         float _Tween(float goalValue, float percentage);
         void _ExecuteCurrentCommand(float percentage);
-        const Json::Value& _GetCurrentCommand() const;
-        bool _IsDiscreteCommand(const Json::Value&) const;
+        bool _IsCurrentCommandDiscrete() const;
+        Path* _GetSlot(unsigned int slot) const;
     private:
         tween::Tweener _tween;
-        const Json::Value* _history;
+        Commands _commands;
+        std::vector<unsigned int> _slotLists;
+        PathList _slots;
         sketch::Scene* _scene;
         float _commandDuration;
         unsigned _currentCommand;
         float _currentCommandStartTime;
         float _previousTime;
-        PathHandles _handles;
+        bool _started;
+        Checkpoints _checkpoints;
         FloatList _originalPlanes;
+        FloatList _newPlanes;
+        PathList _paths;
+        PathList _walls;
         sketch::Tessellator* _tess;
+
+        friend class BakedPlayback;
     };
 }
@@ -8,27 +8,43 @@
 #include "glm/gtx/rotate_vector.hpp"
 
 #include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <set>
 
 using namespace sketch;
 using namespace glm;
 using namespace std;
 
-Scene::Scene() : _threshold(0.0001)
+// Set with Scene::EnableLinearWelding.
+static bool _linearWelding = false;
+
+// Granularity of GetChangedPoints.  Small enough that moving a roof only
+// re-uploads a few hundred bytes.
+static const unsigned int PointBlockSize = 32;
+
+// Points closer than sqrt(_threshold) are welded together, so using that
+// distance as the grid spacing guarantees that welding candidates are
+// always found in one of the 27 cells surrounding the query point.
+Scene::Scene() : _threshold(0.0001), _cellSize(sqrt(_threshold))
 {
     _recording = true;
-    Plane* ground = new Plane;
-    ground->Eqn = vec4(0, 1, 0, 0);
-    _planes.push_back(ground);
+    _historyExported = 0;
+    // The ground plane is never released.
+    Plane* ground = _InternPlane(vec4(0, 1, 0, 0));
+    ground->RefCount = 1;
     _topologyHash = 0;
+    _edgeLookupsAvoided = 0;
+    _pointStamp = 1;
 }
 
+// Planes are plain old data; paths and edges are destroyed by their
+// handle arrays.  The memory itself goes back to the arena pool in one
+// fell swoop.
 Scene::~Scene()
 {
-    FOR_EACH(p, _paths) { delete *p; }
-    FOR_EACH(h, _holes) { delete *h; }
-    FOR_EACH(p, _planes) { delete *p; }
-    FOR_EACH(e, _edges) { delete *e; }
 }
 
 const Plane*
@@ -53,25 +69,21 @@ Scene::AddQuad(sketch::Quad q)
     unsigned int d = _AppendPoint(q.p - q.u + q.v);
 
     // Initialize the path object.
-    CoplanarPath* retval = new CoplanarPath();
-    retval->Visible = true;
-    _topologyHash++;
+    CoplanarPath* retval = _NewPath();
     _AppendEdge(retval, a, b);
     _AppendEdge(retval, b, c);
     _AppendEdge(retval, c, d);
     _AppendEdge(retval, d, a);
-    retval->Plane = const_cast<Plane*>(plane);
+    _SetPathPlane(retval, plane);
     _FinalizePath(retval, _threshold);
+    _pathListTracker.Touch(_paths.size());
     _paths.push_back(retval);
 
     if (_recording) {
-        string p = toString(q.p);
-        string u = toString(q.u);
-        string v = toString(q.v);
-        appendJson(
-            _history,
-            "[ \"AddQuad\", \"%8.8x\", %s, %s, %s]",
-            retval, p.c_str(), u.c_str(), v.c_str() );
+        HistoryEntry& entry = _Record(HISTORY_ADD_QUAD, retval);
+        entry.P = q.p;
+        entry.U = q.u;
+        entry.V = q.v;
     }
 
     return retval;
@@ -91,22 +103,22 @@ Scene::AddRectangle(float width, float height, vec4 eqn, vec2 offset)
     unsigned int c = _AppendPoint(AddOffset(offset + vec2(+hw, +hh), plane));
     unsigned int d = _AppendPoint(AddOffset(offset + vec2(-hw, +hh), plane));
 
-    retval = new CoplanarPath();
-    retval->Visible = true;
-    _topologyHash++;
+    retval = _NewPath();
     _AppendEdge(retval, a, b);
     _AppendEdge(retval, b, c);
     _AppendEdge(retval, c, d);
     _AppendEdge(retval, d, a);
-    retval->Plane = const_cast<Plane*>(plane);
+    _SetPathPlane(retval, plane);
     _FinalizePath(retval, _threshold);
+    _pathListTracker.Touch(_paths.size());
     _paths.push_back(retval);
 
     if (_recording) {
-        appendJson(
-            _history,
-            "[ \"AddRectangle\", \"%8.8x\", %f, %f, %s, %s]",
-            retval, width, height, toString(eqn), toString(offset) );
+        HistoryEntry& entry = _Record(HISTORY_ADD_RECTANGLE, retval);
+        entry.Width = width;
+        entry.Height = height;
+        entry.Eqn = eqn;
+        entry.Offset = offset;
     }
     return retval;
 }
@@ -122,9 +134,7 @@ Scene::AddPolygon(float radius, vec4 eqn, vec2 offset, int numPoints)
     const float dtheta = twopi / numPoints;
     float theta = 0;
 
-    retval = new CoplanarPath();
-    retval->Visible = true;
-    _topologyHash++;
+    retval = _NewPath();
     unsigned firstIndex = 0;
     for (int i = 0; i < numPoints; ++i, theta += dtheta) {
         vec2 p = radius * vec2(sin(theta), cos(theta));
@@ -139,15 +149,17 @@ Scene::AddPolygon(float radius, vec4 eqn, vec2 offset, int numPoints)
         _AppendEdge(retval, index, nextIndex);
     }
 
-    retval->Plane = const_cast<Plane*>(plane);
+    _SetPathPlane(retval, plane);
     _FinalizePath(retval, _threshold);
+    _pathListTracker.Touch(_paths.size());
     _paths.push_back(retval);
 
     if (_recording) {
-        appendJson(
-            _history,
-            "[ \"AddPolygon\", \"%8.8x\", %f, %s, %s, %d]",
-            retval, radius, toString(eqn), toString(offset), numPoints );
+        HistoryEntry& entry = _Record(HISTORY_ADD_POLYGON, retval);
+        entry.Width = radius;
+        entry.Eqn = eqn;
+        entry.Offset = offset;
+        entry.NumPoints = numPoints;
     }
     return retval;
 }
@@ -169,21 +181,18 @@ Scene::AddInscribedRectangle(float width, float height,
     CoplanarPath* inner = AddRectangle(width, height, plane->Eqn, offset);
     _recording = previous;
 
-    CoplanarPath* hole = new CoplanarPath();
-    hole->Visible = true;
-    _topologyHash++;
+    CoplanarPath* hole = _NewPath();
     FOR_EACH(edge, inner->Edges) {
         _AppendEdge(hole, *edge);
     }
-    hole->Plane = inner->Plane;
-    outer->Holes.push_back(hole);
-    _holes.push_back(hole);
+    _SetPathPlane(hole, inner->Plane);
+    _AddHole(outer, hole);
 
     if (_recording) {
-        appendJson(
-            _history,
-            "[ \"AddInscribedRectangle\", \"%8.8x\", %f, %f, \"%8.8x\", %s]",
-            inner, width, height, outer, toString(pathOffset) );
+        HistoryEntry& entry = _Record(HISTORY_ADD_INSCRIBED_RECTANGLE, inner, outer);
+        entry.Width = width;
+        entry.Height = height;
+        entry.Offset = pathOffset;
     }
 
     return inner;
@@ -198,15 +207,12 @@ Scene::AddInscribedQuad(sketch::Quad q,
     CoplanarPath* inner = AddQuad(q);
     _recording = previous;
 
-    CoplanarPath* hole = new CoplanarPath();
-    hole->Visible = true;
-    _topologyHash++;
+    CoplanarPath* hole = _NewPath();
     FOR_EACH(edge, inner->Edges) {
         _AppendEdge(hole, *edge);
     }
-    hole->Plane = inner->Plane;
-    outer->Holes.push_back(hole);
-    _holes.push_back(hole);
+    _SetPathPlane(hole, inner->Plane);
+    _AddHole(outer, hole);
 
     return inner;
 }
@@ -232,24 +238,21 @@ Scene::AddHoleRectangle(float width, float height,
     unsigned int c = _AppendPoint(AddOffset(offset + vec2(+hw, +hh), plane));
     unsigned int d = _AppendPoint(AddOffset(offset + vec2(-hw, +hh), plane));
 
-    CoplanarPath* hole = new CoplanarPath();
-    hole->Visible = true;
-    _topologyHash++;
+    CoplanarPath* hole = _NewPath();
 
     _AppendEdge(hole, a, b);
     _AppendEdge(hole, b, c);
     _AppendEdge(hole, c, d);
     _AppendEdge(hole, d, a);
 
-    hole->Plane = outer->Plane;
-    outer->Holes.push_back(hole);
-    _holes.push_back(hole);
+    _SetPathPlane(hole, outer->Plane);
+    _AddHole(outer, hole);
 
     if (_recording) {
-        appendJson(
-            _history,
-            "[ \"AddHoleRectangle\", \"%8.8x\", %f, %f, \"%8.8x\", %s]",
-            hole, width, height, outer, toString(pathOffset) );
+        HistoryEntry& entry = _Record(HISTORY_ADD_HOLE_RECTANGLE, hole, outer);
+        entry.Width = width;
+        entry.Height = height;
+        entry.Offset = pathOffset;
     }
 
     return hole;
@@ -264,27 +267,21 @@ Scene::AddHoleQuad(Quad q, sketch::CoplanarPath* outer)
     unsigned int c = _AppendPoint(q.p + q.u + q.v);
     unsigned int d = _AppendPoint(q.p - q.u + q.v);
 
-    CoplanarPath* hole = new CoplanarPath();
-    hole->Visible = true;
-    _topologyHash++;
+    CoplanarPath* hole = _NewPath();
 
     _AppendEdge(hole, a, b);
     _AppendEdge(hole, b, c);
     _AppendEdge(hole, c, d);
     _AppendEdge(hole, d, a);
 
-    hole->Plane = outer->Plane;
-    outer->Holes.push_back(hole);
-    _holes.push_back(hole);
+    _SetPathPlane(hole, outer->Plane);
+    _AddHole(outer, hole);
 
     if (_recording) {
-        string p = toString(q.p);
-        string u = toString(q.u);
-        string v = toString(q.v);
-        appendJson(
-            _history,
-            "[ \"AddHoleQuad\", \"%8.8x\", %s, %s, %s, \"%8.8x\"]",
-            hole, p.c_str(), u.c_str(), v.c_str(), outer );
+        HistoryEntry& entry = _Record(HISTORY_ADD_HOLE_QUAD, hole, outer);
+        entry.P = q.p;
+        entry.U = q.u;
+        entry.V = q.v;
     }
 
     return hole;
@@ -306,21 +303,18 @@ Scene::AddInscribedPolygon(float radius, sketch::CoplanarPath* outer,
     CoplanarPath* inner = AddPolygon(radius, plane->Eqn, offset, numPoints);
     _recording = previous;
 
-    CoplanarPath* hole = new CoplanarPath();
-    hole->Visible = true;
-    _topologyHash++;
+    CoplanarPath* hole = _NewPath();
     FOR_EACH(edge, inner->Edges) {
         _AppendEdge(hole, *edge);
     }
-    hole->Plane = inner->Plane;
-    outer->Holes.push_back(hole);
-    _holes.push_back(hole);
+    _SetPathPlane(hole, inner->Plane);
+    _AddHole(outer, hole);
 
     if (_recording) {
-        appendJson(
-            _history,
-            "[ \"AddInscribedPolygon\", \"%8.8x\", %f, \"%8.8x\", %s, %d]",
-            inner, radius, outer, toString(pathOffset), numPoints );
+        HistoryEntry& entry = _Record(HISTORY_ADD_INSCRIBED_POLYGON, inner, outer);
+        entry.Width = radius;
+        entry.Offset = pathOffset;
+        entry.NumPoints = numPoints;
     }
 
     return inner;
@@ -332,27 +326,25 @@ Scene::PushPaths(PathList paths, float delta, ExtrusionVisibility vis)
     bool previous = _recording;
     _recording = false;
     FOR_EACH(p, paths) {
-        CoplanarPath* cp = dynamic_cast<CoplanarPath*>(*p);
+        CoplanarPath* cp = AsCoplanar(*p);
         if (!cp) {
             pezFatal("Non-coplanar paths aren't really supported yet.");
         }
         PathList walls;
         PushPath(cp, delta, &walls);
         if (vis == HIDE) {
-            FOR_EACH(w, walls) { (*w)->Visible = false; }
+            FOR_EACH(w, walls) { _TouchPath(*w); (*w)->Visible = false; }
         }
         if (vis == SHOW) {
-            FOR_EACH(w, walls) { (*w)->Visible = true; }
+            FOR_EACH(w, walls) { _TouchPath(*w); (*w)->Visible = true; }
         }
     }
     _recording = previous;
 
     if (_recording) {
-        const char* handleList = toString((void**) &(paths[0]), paths.size());
-        appendJson(
-            _history,
-            "[ \"PushPaths\", %s, %f]",
-            handleList, delta );
+        HistoryEntry& entry = _Record(HISTORY_PUSH_PATHS, 0);
+        entry.Width = delta;
+        _RecordPaths(&entry, paths);
     }
 }
 
@@ -365,27 +357,26 @@ Scene::PushPath(CoplanarPath* path, float delta, PathList* pWalls)
     // Extrude edges into new coplanar paths
     EdgeList newEdges;
     bool alreadyExtruded = false;
-    set<unsigned> vertsToPush;
+    IndexList vertsToPush;
     FOR_EACH(e, path->Edges) {
         FOR_EACH(f, (*e)->Faces) {
             if (*f == path) {
                 continue;
             }
-            CoplanarPath* cp = dynamic_cast<CoplanarPath*>(*f);
+            CoplanarPath* cp = AsCoplanar(*f);
             if (!cp) {
                 pezFatal("Non-coplanar paths aren't really supported yet.");
             }
             if (IsOrthogonal(path, cp, _threshold)) {
                 uvec2 ends = (*e)->Endpoints;
-                vertsToPush.insert(ends.x);
-                vertsToPush.insert(ends.y);
+                vertsToPush.push_back(ends.x);
+                vertsToPush.push_back(ends.y);
                 walls.push_back(*f);
                 alreadyExtruded = true;
             }
         }
         if (!alreadyExtruded) {
-            Arc* arc = dynamic_cast<Arc*>(*e);
-            if (arc) {
+            if (IsArc(*e)) {
                 pezFatal("Arc extrusion isn't supported yet.");
             }
             Edge* ab = *e;
@@ -393,25 +384,28 @@ Scene::PushPath(CoplanarPath* path, float delta, PathList* pWalls)
             unsigned int b = ab->Endpoints.y;
             unsigned int c = _AppendPoint(_points[b] + pushVector);
             unsigned int d = _AppendPoint(_points[a] + pushVector);
-            CoplanarPath* f = new CoplanarPath();
-            f->Visible = true;
-            _topologyHash++;
+            CoplanarPath* f = _NewPath();
             _AppendEdge(f, ab);
             _AppendEdge(f, b, c);
             Edge* cd = _AppendEdge(f, c, d);
             Edge* da = _AppendEdge(f, d, a);
             vec3 vab = _GetEdgeVector(ab);
             vec3 vda = _GetEdgeVector(da);
-            f->Plane = _GetPlane(_points[a], vab, -vda);
+            _SetPathPlane(f, _GetPlane(_points[a], vab, -vda));
             _VerifyPlane(f, "Faulty path plane in PushPath 1.");
+            _pathListTracker.Touch(_paths.size());
             _paths.push_back(f);
             walls.push_back(f);
             newEdges.push_back(cd);
         }
     }
 
+    std::sort(vertsToPush.begin(), vertsToPush.end());
+    vertsToPush.erase(
+        std::unique(vertsToPush.begin(), vertsToPush.end()),
+        vertsToPush.end());
     FOR_EACH(v, vertsToPush) {
-        _points[*v] += pushVector;
+        _MovePoint(*v, _points[*v] + pushVector);
     }
 
     vec4 eqn = path->Plane->Eqn;
@@ -423,20 +417,23 @@ Scene::PushPath(CoplanarPath* path, float delta, PathList* pWalls)
         FOR_EACH(e, path->Edges) {
             PathList::iterator pe =
                 std::find((*e)->Faces.begin(), (*e)->Faces.end(), path);
+            _TouchEdge(*e);
             (*e)->Faces.erase(pe);
         }
+        _TouchPath(path);
         path->Edges.clear();
         path->Edges.swap(newEdges);
+        path->Generation++;
         FOR_EACH(e, path->Edges) {
+            _TouchEdge(*e);
             (*e)->Faces.push_back(path);
         }
 
         // Update the path plane
-        Plane* newPlane = const_cast<Plane*>(GetPlane(eqn));
-        path->Plane = newPlane;
+        _SetPathPlane(path, GetPlane(eqn));
 
     } else {
-        path->Plane->Eqn = eqn;
+        _MovePathPlane(path, eqn);
     }
 
     _VerifyPlane(path, "Faulty path plane in PushPath 2.");
@@ -454,11 +451,9 @@ Scene::PushPath(CoplanarPath* path, float delta, PathList* pWalls)
 
     // Record for posterity
     if (_recording) {
-        const char* handleList = toString((void**) &(walls[0]), walls.size());
-        appendJson(
-            _history,
-            "[ \"PushPath\", \"%8.8x\", %f, %s]",
-            path, delta, handleList );
+        HistoryEntry& entry = _Record(HISTORY_PUSH_PATH, path);
+        entry.Width = delta;
+        _RecordPaths(&entry, walls);
     }
 
     // Return the extrusion walls if the client is interested
@@ -478,30 +473,124 @@ Scene::SetPathPlane(CoplanarPath* path, float w)
 }
 
 void
-Scene::SetPathPlanes(PathList paths, FloatList ws)
+Scene::SetPathPlanes(const PathList& paths, const FloatList& ws)
 {
     bool previous = _recording;
     _recording = false;
     for (size_t i = 0; i < paths.size(); ++i) {
-        CoplanarPath* cop = dynamic_cast<CoplanarPath*>(paths[i]);
+        CoplanarPath* cop = AsCoplanar(paths[i]);
         float delta = ws[i] - cop->Plane->Eqn.w;
         PushPath(cop, delta);
     }
     _recording = previous;
 }
 
+void
+Scene::RigExtrusion(CoplanarPath* path, ExtrusionRig* rig) const
+{
+    rig->Path = path;
+    rig->Generation = path->Generation;
+    rig->Points.clear();
+    FOR_EACH(e, path->Edges) {
+        FOR_EACH(f, (*e)->Faces) {
+            if (*f == path) {
+                continue;
+            }
+            CoplanarPath* cp = AsCoplanar(*f);
+            if (cp && IsOrthogonal(path, cp, _threshold)) {
+                rig->Points.push_back((*e)->Endpoints.x);
+                rig->Points.push_back((*e)->Endpoints.y);
+            }
+        }
+    }
+    std::sort(rig->Points.begin(), rig->Points.end());
+    rig->Points.erase(
+        std::unique(rig->Points.begin(), rig->Points.end()),
+        rig->Points.end());
+    pezCheck(!rig->Points.empty(), "Only existing extrusions can be rigged.");
+}
+
+void
+Scene::SetRigPlane(const ExtrusionRig& rig, float w)
+{
+    CoplanarPath* path = rig.Path;
+    pezCheck(rig.Generation == path->Generation, "Stale extrusion rig.");
+    float delta = w - path->Plane->Eqn.w;
+    vec3 pushVector = delta * path->GetNormal();
+    FOR_EACH(v, rig.Points) {
+        _MovePoint(*v, _points[*v] + pushVector);
+    }
+    vec4 eqn = path->Plane->Eqn;
+    eqn.w += delta;
+    _MovePathPlane(path, eqn);
+}
+
+// Offsets are accumulated before anything moves, so points that are shared
+// by several rigs are only re-keyed in the point grid once.
+void
+Scene::SetRigPlanes(const ExtrusionRig* rigs, const float* ws, size_t count)
+{
+    _rigOffsets.resize(_points.size(), vec3(0));
+    _rigPoints.clear();
+    for (size_t i = 0; i < count; ++i) {
+        CoplanarPath* path = rigs[i].Path;
+        pezCheck(rigs[i].Generation == path->Generation, "Stale extrusion rig.");
+        float delta = ws[i] - path->Plane->Eqn.w;
+        vec3 pushVector = delta * path->GetNormal();
+        FOR_EACH(v, rigs[i].Points) {
+            _rigOffsets[*v] += pushVector;
+        }
+        _rigPoints.insert(_rigPoints.end(), rigs[i].Points.begin(), rigs[i].Points.end());
+        vec4 eqn = path->Plane->Eqn;
+        eqn.w += delta;
+        _MovePathPlane(path, eqn);
+    }
+    std::sort(_rigPoints.begin(), _rigPoints.end());
+    _rigPoints.erase(
+        std::unique(_rigPoints.begin(), _rigPoints.end()),
+        _rigPoints.end());
+    FOR_EACH(v, _rigPoints) {
+        _MovePoint(*v, _points[*v] + _rigOffsets[*v]);
+        _rigOffsets[*v] = vec3(0);
+    }
+}
+
+CoplanarPath*
+Scene::_NewPath()
+{
+    CoplanarPath* path = _pathObjects.Append(&_arena);
+    path->Visible = true;
+    path->Index = _pathObjects.size() - 1;
+    _topologyHash++;
+    return path;
+}
+
+void
+Scene::_AddHole(CoplanarPath* outer, CoplanarPath* hole)
+{
+    _TouchPath(outer);
+    outer->Holes.push_back(hole);
+    outer->Generation++;
+    _holeListTracker.Touch(_holes.size());
+    _holes.push_back(hole);
+}
+
 Edge*
 Scene::_AppendEdge(Path* path, unsigned int a, unsigned int b)
 {
-    FOR_EACH(i, _edges) {
-        if ((*i)->Endpoints == uvec2(a, b) ||
-            (*i)->Endpoints == uvec2(b, a)) {
-            _AppendEdge(path, *i);
-            return *i;
-        }
+    _edgeLookupsAvoided += _edges.size();
+    uvec2 key = _GetEdgeKey(a, b);
+    EdgeMap::iterator i = _edgeMap.find(key);
+    if (i != _edgeMap.end()) {
+        _AppendEdge(path, i->second);
+        return i->second;
     }
-    Edge* e = new Edge();
+    Edge* e = _edgeObjects.Append(&_arena);
     e->Endpoints = uvec2(a, b);
+    e->Index = _edgeObjects.size() - 1;
+    _edgeListTracker.Touch(_edges.size());
+    _edges.push_back(e);
+    _edgeMap[key] = e;
     _AppendEdge(path, e);
     return e;
 }
@@ -509,6 +598,8 @@ Scene::_AppendEdge(Path* path, unsigned int a, unsigned int b)
 void
 Scene::_AppendEdge(Path* path, Edge* e)
 {
+    _TouchEdge(e);
+    _TouchPath(path);
     e->Faces.push_back(path);
     path->Edges.push_back(e);
 }
@@ -519,7 +610,7 @@ Scene::_AppendEdge(Path* path, Edge* e)
 bool
 Scene::_FinalizePath(Path* path, float epsilon)
 {
-    CoplanarPath* coplanar = dynamic_cast<CoplanarPath*>(path);
+    CoplanarPath* coplanar = AsCoplanar(path);
     if (coplanar) {
         // TODO check if the plane can be snapped.  If so, adjust points accordingly.
     }
@@ -534,15 +625,125 @@ Scene::_FinalizePath(Path* path, float epsilon)
 unsigned int
 Scene::_AppendPoint(vec3 p)
 {
-    FOR_EACH(i, _points) {
-        if (distance2(*i, p) < _threshold) {
-            return i - _points.begin();
+    if (_linearWelding) {
+        FOR_EACH(i, _points) {
+            if (distance2(*i, p) < _threshold) {
+                return i - _points.begin();
+            }
+        }
+    } else {
+        int existing = _FindPoint(p);
+        if (existing >= 0) {
+            return existing;
         }
     }
+    _TouchPoint(_points.size());
     _points.push_back(p);
+    _pointGrid[_GetCell(p)].push_back(_points.size() - 1);
     return _points.size() - 1;
 }
 
+void
+Scene::EnableLinearWelding(bool enabled)
+{
+    _linearWelding = enabled;
+}
+
+// Returns the smallest matching index, which is what a front-to-back
+// scan of _points would have found.
+int
+Scene::_FindPoint(vec3 p) const
+{
+    int retval = -1;
+    ivec3 cell = _GetCell(p);
+    ivec3 neighbor;
+    for (neighbor.x = cell.x - 1; neighbor.x <= cell.x + 1; ++neighbor.x) {
+    for (neighbor.y = cell.y - 1; neighbor.y <= cell.y + 1; ++neighbor.y) {
+    for (neighbor.z = cell.z - 1; neighbor.z <= cell.z + 1; ++neighbor.z) {
+        PointGrid::const_iterator i = _pointGrid.find(neighbor);
+        if (i == _pointGrid.end()) {
+            continue;
+        }
+        FOR_EACH(j, i->second) {
+            int index = int(*j);
+            if (retval >= 0 && index > retval) {
+                continue;
+            }
+            if (distance2(_points[index], p) < _threshold) {
+                retval = index;
+            }
+        }
+    }
+    }
+    }
+    return retval;
+}
+
+void
+Scene::_MovePoint(unsigned int i, vec3 p)
+{
+    ivec3 oldCell = _GetCell(_points[i]);
+    ivec3 newCell = _GetCell(p);
+    _TouchPoint(i);
+    if (oldCell == newCell) {
+        _points[i] = p;
+        return;
+    }
+    _UnlinkPoint(i);
+    _points[i] = p;
+    _pointGrid[newCell].push_back(i);
+}
+
+void
+Scene::_UnlinkPoint(unsigned int i)
+{
+    ivec3 cell = _GetCell(_points[i]);
+    IndexList& list = _pointGrid[cell];
+    list.erase(std::find(list.begin(), list.end(), i));
+    if (list.empty()) {
+        _pointGrid.erase(cell);
+    }
+}
+
+void
+Scene::_TouchPoint(unsigned int i)
+{
+    _pointTracker.Touch(i);
+    unsigned int block = i / PointBlockSize;
+    if (block >= _pointStamps.size()) {
+        _pointStamps.resize(block + 1, 0);
+    }
+    _pointStamps[block] = _pointStamp;
+}
+
+// Every call advances the stamp, so points that change afterwards are
+// newer than the returned value even if they change within the same frame.
+unsigned int
+Scene::GetChangedPoints(unsigned int since, vector<uvec2>* ranges) const
+{
+    ranges->clear();
+    unsigned int size = _points.size();
+    for (unsigned int block = 0; block < _pointStamps.size(); ++block) {
+        unsigned int begin = block * PointBlockSize;
+        unsigned int end = std::min(begin + PointBlockSize, size);
+        if (_pointStamps[block] <= since || begin >= end) {
+            continue;
+        }
+        if (!ranges->empty() && ranges->back().y == begin) {
+            ranges->back().y = end;
+        } else {
+            ranges->push_back(uvec2(begin, end));
+        }
+    }
+    return _pointStamp++;
+}
+
+ivec3
+Scene::_GetCell(vec3 p) const
+{
+    return ivec3(floor(p / _cellSize));
+}
+
 static vec3
 _perp(vec3 a)
 {
@@ -630,10 +831,7 @@ Scene::_GetPlane(vec3 p, vec3 u, vec3 v)
         eqn = -eqn;
     }
 
-    Plane* plane = new Plane;
-    plane->Eqn = eqn;
-    _planes.push_back(plane);
-    return plane;
+    return _InternPlane(eqn);
 }
 
 // Canonicalize by scaling length of eqn.xyz with eqn.w.
@@ -648,13 +846,93 @@ Scene::GetPlane(vec4 eqn)
         eqn = -eqn;
     }
 
-    // TODO check if there's an existing plane within _threshold
-    // If so, return that instead.
+    return _InternPlane(eqn);
+}
 
-    Plane* p = new Plane;
-    p->Eqn = eqn;
-    _planes.push_back(p);
-    return p;
+// Planes that fall into the same quantization cell are considered
+// identical; dead planes are recycled rather than deleted.
+Plane*
+Scene::_InternPlane(vec4 eqn)
+{
+    PlaneMap::iterator i = _planeMap.find(_GetPlaneKey(eqn));
+    if (i != _planeMap.end()) {
+        return i->second;
+    }
+    return _AllocPlane(eqn);
+}
+
+Plane*
+Scene::_AllocPlane(vec4 eqn)
+{
+    Plane* plane;
+    if (_freePlanes.empty()) {
+        plane = _arena.New<Plane>();
+        plane->Index = _planes.size();
+        _planes.push_back(plane);
+    } else {
+        plane = _freePlanes.back();
+        _freePlanes.pop_back();
+    }
+    _TouchPlane(plane);
+    plane->Eqn = eqn;
+    plane->RefCount = 0;
+    _planeMap.insert(PlaneMap::value_type(_GetPlaneKey(eqn), plane));
+    return plane;
+}
+
+ivec4
+Scene::_GetPlaneKey(vec4 eqn) const
+{
+    return ivec4(floor(eqn / _threshold + 0.5f));
+}
+
+void
+Scene::_SetPathPlane(CoplanarPath* path, const Plane* plane)
+{
+    Plane* previous = path->Plane;
+    _TouchPath(path);
+    path->Plane = const_cast<Plane*>(plane);
+    _TouchPlane(path->Plane);
+    path->Plane->RefCount++;
+    if (previous) {
+        _ReleasePlane(previous);
+    }
+}
+
+// Unlike GetPlane, this never snaps to an existing plane, since the
+// path's points have already been moved by the exact amount.
+void
+Scene::_MovePathPlane(CoplanarPath* path, vec4 eqn)
+{
+    Plane* plane = path->Plane;
+    if (plane->RefCount > 1) {
+        _SetPathPlane(path, _AllocPlane(eqn));
+        return;
+    }
+    _UnmapPlane(plane);
+    _TouchPlane(plane);
+    plane->Eqn = eqn;
+    _planeMap.insert(PlaneMap::value_type(_GetPlaneKey(eqn), plane));
+}
+
+void
+Scene::_ReleasePlane(Plane* plane)
+{
+    _TouchPlane(plane);
+    if (--plane->RefCount > 0) {
+        return;
+    }
+    _UnmapPlane(plane);
+    _freePlanes.push_back(plane);
+}
+
+void
+Scene::_UnmapPlane(Plane* plane)
+{
+    PlaneMap::iterator i = _planeMap.find(_GetPlaneKey(plane->Eqn));
+    if (i != _planeMap.end() && i->second == plane) {
+        _planeMap.erase(i);
+    }
 }
 
 Json::Value
@@ -669,10 +947,343 @@ Scene::Serialize() const
     return root;
 }
 
+struct Scene::PlaneStateGetter
+{
+    PlaneStateGetter(const Scene* scene) : _scene(scene) {}
+    PlaneState operator()(Plane* const& plane) const
+    {
+        PlaneState state;
+        state.Eqn = plane->Eqn;
+        state.RefCount = plane->RefCount;
+        PlaneMap::const_iterator i =
+            _scene->_planeMap.find(_scene->_GetPlaneKey(plane->Eqn));
+        state.Mapped = i != _scene->_planeMap.end() && i->second == plane;
+        return state;
+    }
+    const Scene* _scene;
+};
+
+// Layout of the binary image written by Scene::WriteBinary.  The header is
+// followed by one array per count, in the order that the counts appear.
+// Paths, edges and planes refer to each other by index.
+static const unsigned int BinaryMagic = 0x48434b53; // "SKCH"
+static const unsigned int BinaryVersion = 1;
+static const unsigned int NoPlane = ~0u;
+
+struct BinaryHeader
+{
+    unsigned int Magic;
+    unsigned int Version;
+    unsigned int ByteCount;
+    unsigned int NumPoints;
+    unsigned int NumPlanes;
+    unsigned int NumEdges;
+    unsigned int NumPaths;
+    unsigned int NumSceneEdges;
+    unsigned int NumScenePaths;
+    unsigned int NumSceneHoles;
+    unsigned int NumFreePlanes;
+    unsigned int NumRefs;
+};
+
+struct BinaryPlane
+{
+    vec4 Eqn;
+    unsigned int RefCount;
+    unsigned int Mapped;
+};
+
+// Faces are stored in the shared array of references.
+struct BinaryEdge
+{
+    uvec2 Endpoints;
+    unsigned int FirstFace;
+    unsigned int NumFaces;
+};
+
+// Ditto for edges and holes.
+struct BinaryPath
+{
+    unsigned int FirstEdge;
+    unsigned int NumEdges;
+    unsigned int FirstHole;
+    unsigned int NumHoles;
+    unsigned int Plane;
+    unsigned int Visible;
+    unsigned int Type;
+    unsigned int Generation;
+};
+
+template<class T> static void
+_AppendRecords(Blob* dest, const vector<T>& records)
+{
+    if (records.empty()) {
+        return;
+    }
+    const unsigned char* bytes = (const unsigned char*) &records[0];
+    dest->insert(dest->end(), bytes, bytes + records.size() * sizeof(T));
+}
+
+// Returns the records that follow the given ones, or null if they would run
+// past the end of the image.  Propagates null.
+template<class T> static const T*
+_SkipRecords(const T* records, unsigned int count, const unsigned char* end)
+{
+    if (!records || size_t(end - (const unsigned char*) records) / sizeof(T) < count) {
+        return 0;
+    }
+    return records + count;
+}
+
+// Checks that refs[first] through refs[first + count - 1] exist, and that
+// each of them is less than the given bound.
+static bool
+_AreRefsValid(const unsigned int* refs,
+              unsigned int numRefs,
+              unsigned int first,
+              unsigned int count,
+              unsigned int bound)
+{
+    if (count > numRefs || first > numRefs - count) {
+        return false;
+    }
+    for (unsigned int i = first; i < first + count; ++i) {
+        if (refs[i] >= bound) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every path and edge object is written, including those that are unreachable
+// since restoring a snapshot, so that object indices survive the round trip.
+void
+Scene::WriteBinary(Blob* dest) const
+{
+    PlaneStateGetter getPlaneState(this);
+    vector<BinaryPlane> planes(_planes.size());
+    for (size_t i = 0; i < _planes.size(); ++i) {
+        PlaneState state = getPlaneState(_planes[i]);
+        planes[i].Eqn = state.Eqn;
+        planes[i].RefCount = state.RefCount;
+        planes[i].Mapped = state.Mapped;
+    }
+
+    IndexList refs;
+    vector<BinaryEdge> edges(_edgeObjects.size());
+    for (size_t i = 0; i < _edgeObjects.size(); ++i) {
+        const Edge* e = &_edgeObjects[i];
+        pezCheck(!IsArc(e), "Arc serialization isn't supported yet.");
+        edges[i].Endpoints = e->Endpoints;
+        edges[i].FirstFace = refs.size();
+        edges[i].NumFaces = e->Faces.size();
+        FOR_EACH(f, e->Faces) {
+            refs.push_back((*f)->Index);
+        }
+    }
+
+    vector<BinaryPath> paths(_pathObjects.size());
+    for (size_t i = 0; i < _pathObjects.size(); ++i) {
+        const Path* path = &_pathObjects[i];
+        const CoplanarPath* cop = AsCoplanar(path);
+        paths[i].FirstEdge = refs.size();
+        paths[i].NumEdges = path->Edges.size();
+        FOR_EACH(e, path->Edges) {
+            refs.push_back((*e)->Index);
+        }
+        paths[i].FirstHole = refs.size();
+        paths[i].NumHoles = path->Holes.size();
+        FOR_EACH(h, path->Holes) {
+            refs.push_back((*h)->Index);
+        }
+        paths[i].Plane = (cop && cop->Plane) ? cop->Plane->Index : NoPlane;
+        paths[i].Visible = path->Visible;
+        paths[i].Type = path->Type;
+        paths[i].Generation = path->Generation;
+    }
+
+    IndexList sceneEdges, scenePaths, sceneHoles, freePlanes;
+    FOR_EACH(e, _edges) { sceneEdges.push_back((*e)->Index); }
+    FOR_EACH(p, _paths) { scenePaths.push_back((*p)->Index); }
+    FOR_EACH(h, _holes) { sceneHoles.push_back((*h)->Index); }
+    FOR_EACH(p, _freePlanes) { freePlanes.push_back((*p)->Index); }
+
+    vector<BinaryHeader> header(1);
+    header[0].Magic = BinaryMagic;
+    header[0].Version = BinaryVersion;
+    header[0].NumPoints = _points.size();
+    header[0].NumPlanes = planes.size();
+    header[0].NumEdges = edges.size();
+    header[0].NumPaths = paths.size();
+    header[0].NumSceneEdges = sceneEdges.size();
+    header[0].NumScenePaths = scenePaths.size();
+    header[0].NumSceneHoles = sceneHoles.size();
+    header[0].NumFreePlanes = freePlanes.size();
+    header[0].NumRefs = refs.size();
+
+    size_t start = dest->size();
+    _AppendRecords(dest, header);
+    _AppendRecords(dest, _points);
+    _AppendRecords(dest, planes);
+    _AppendRecords(dest, edges);
+    _AppendRecords(dest, paths);
+    _AppendRecords(dest, sceneEdges);
+    _AppendRecords(dest, scenePaths);
+    _AppendRecords(dest, sceneHoles);
+    _AppendRecords(dest, freePlanes);
+    _AppendRecords(dest, refs);
+
+    unsigned int byteCount = dest->size() - start;
+    memcpy(&(*dest)[start] + offsetof(BinaryHeader, ByteCount), &byteCount, sizeof(byteCount));
+}
+
+size_t
+Scene::ReadBinary(const Blob& src, size_t offset)
+{
+    if (offset >= src.size()) {
+        return 0;
+    }
+    size_t size = ReadBinary(&src[offset], src.size() - offset);
+    return size ? offset + size : 0;
+}
+
+size_t
+Scene::ReadBinary(const void* src, size_t size)
+{
+    pezCheck(_pathObjects.empty() && _points.empty() && _planes.size() == 1,
+             "Sketch images can only be loaded into empty scenes.");
+
+    const unsigned char* bytes = (const unsigned char*) src;
+    const BinaryHeader* header = (const BinaryHeader*) bytes;
+    if (size < sizeof(BinaryHeader) ||
+        header->Magic != BinaryMagic ||
+        header->Version != BinaryVersion ||
+        header->ByteCount < sizeof(BinaryHeader) ||
+        header->ByteCount > size ||
+        header->NumPlanes == 0) {
+        return 0;
+    }
+
+    const unsigned char* end = bytes + header->ByteCount;
+    const vec3* points = (const vec3*) (header + 1);
+    const BinaryPlane* planes = (const BinaryPlane*) _SkipRecords(points, header->NumPoints, end);
+    const BinaryEdge* edges = (const BinaryEdge*) _SkipRecords(planes, header->NumPlanes, end);
+    const BinaryPath* paths = (const BinaryPath*) _SkipRecords(edges, header->NumEdges, end);
+    const unsigned int* sceneEdges = (const unsigned int*) _SkipRecords(paths, header->NumPaths, end);
+    const unsigned int* scenePaths = _SkipRecords(sceneEdges, header->NumSceneEdges, end);
+    const unsigned int* sceneHoles = _SkipRecords(scenePaths, header->NumScenePaths, end);
+    const unsigned int* freePlanes = _SkipRecords(sceneHoles, header->NumSceneHoles, end);
+    const unsigned int* refs = _SkipRecords(freePlanes, header->NumFreePlanes, end);
+    if (!_SkipRecords(refs, header->NumRefs, end)) {
+        return 0;
+    }
+
+    // Check every reference before creating anything, so that a damaged image
+    // leaves the scene empty.
+    unsigned int numRefs = header->NumRefs;
+    for (unsigned int i = 0; i < header->NumEdges; ++i) {
+        if (edges[i].Endpoints.x >= header->NumPoints ||
+            edges[i].Endpoints.y >= header->NumPoints ||
+            !_AreRefsValid(refs, numRefs, edges[i].FirstFace, edges[i].NumFaces, header->NumPaths)) {
+            return 0;
+        }
+    }
+    for (unsigned int i = 0; i < header->NumPaths; ++i) {
+        if ((paths[i].Type != GENERAL_PATH && paths[i].Type != COPLANAR_PATH) ||
+            (paths[i].Plane != NoPlane && paths[i].Plane >= header->NumPlanes) ||
+            !_AreRefsValid(refs, numRefs, paths[i].FirstEdge, paths[i].NumEdges, header->NumEdges) ||
+            !_AreRefsValid(refs, numRefs, paths[i].FirstHole, paths[i].NumHoles, header->NumPaths)) {
+            return 0;
+        }
+    }
+    if (!_AreRefsValid(sceneEdges, header->NumSceneEdges, 0, header->NumSceneEdges, header->NumEdges) ||
+        !_AreRefsValid(scenePaths, header->NumScenePaths, 0, header->NumScenePaths, header->NumPaths) ||
+        !_AreRefsValid(sceneHoles, header->NumSceneHoles, 0, header->NumSceneHoles, header->NumPaths) ||
+        !_AreRefsValid(freePlanes, header->NumFreePlanes, 0, header->NumFreePlanes, header->NumPlanes)) {
+        return 0;
+    }
+
+    // The ground plane is recycled as plane zero.
+    _planeMap.clear();
+    for (unsigned int i = 0; i < header->NumPlanes; ++i) {
+        Plane* plane = i ? _arena.New<Plane>() : _planes.front();
+        plane->Eqn = planes[i].Eqn;
+        plane->RefCount = planes[i].RefCount;
+        plane->Index = i;
+        if (i) {
+            _planes.push_back(plane);
+        }
+        if (planes[i].Mapped) {
+            _planeMap.insert(PlaneMap::value_type(_GetPlaneKey(plane->Eqn), plane));
+        }
+    }
+    for (unsigned int i = 0; i < header->NumFreePlanes; ++i) {
+        _freePlanes.push_back(_planes[freePlanes[i]]);
+    }
+
+    _points.assign(points, points + header->NumPoints);
+    for (unsigned int i = 0; i < header->NumPoints; ++i) {
+        _pointGrid[_GetCell(_points[i])].push_back(i);
+        _TouchPoint(i);
+    }
+
+    // Create all objects before hooking them up, since they refer to each other.
+    for (unsigned int i = 0; i < header->NumEdges; ++i) {
+        Edge* e = _edgeObjects.Append(&_arena);
+        e->Endpoints = edges[i].Endpoints;
+        e->Index = i;
+    }
+    for (unsigned int i = 0; i < header->NumPaths; ++i) {
+        CoplanarPath* path = _pathObjects.Append(&_arena);
+        if (paths[i].Type != COPLANAR_PATH) {
+            path->Type = GENERAL_PATH;
+        } else if (paths[i].Plane != NoPlane) {
+            path->Plane = _planes[paths[i].Plane];
+        }
+        path->Visible = paths[i].Visible;
+        path->Generation = paths[i].Generation;
+        path->Index = i;
+    }
+
+    for (unsigned int i = 0; i < header->NumEdges; ++i) {
+        const unsigned int* faces = refs + edges[i].FirstFace;
+        for (unsigned int j = 0; j < edges[i].NumFaces; ++j) {
+            _edgeObjects[i].Faces.push_back(&_pathObjects[faces[j]]);
+        }
+    }
+    for (unsigned int i = 0; i < header->NumPaths; ++i) {
+        Path* path = &_pathObjects[i];
+        const unsigned int* pathEdges = refs + paths[i].FirstEdge;
+        for (unsigned int j = 0; j < paths[i].NumEdges; ++j) {
+            path->Edges.push_back(&_edgeObjects[pathEdges[j]]);
+        }
+        const unsigned int* holes = refs + paths[i].FirstHole;
+        for (unsigned int j = 0; j < paths[i].NumHoles; ++j) {
+            path->Holes.push_back(&_pathObjects[holes[j]]);
+        }
+    }
+
+    for (unsigned int i = 0; i < header->NumSceneEdges; ++i) {
+        Edge* e = &_edgeObjects[sceneEdges[i]];
+        _edges.push_back(e);
+        _edgeMap[_GetEdgeKey(e->Endpoints.x, e->Endpoints.y)] = e;
+    }
+    for (unsigned int i = 0; i < header->NumScenePaths; ++i) {
+        _paths.push_back(&_pathObjects[scenePaths[i]]);
+    }
+    for (unsigned int i = 0; i < header->NumSceneHoles; ++i) {
+        _holes.push_back(&_pathObjects[sceneHoles[i]]);
+    }
+
+    _topologyHash++;
+    return header->ByteCount;
+}
+
 void
 Scene::SetVisible(Path* path, bool b)
 {
     if (path->Visible != b) {
+        _TouchPath(path);
         _topologyHash++;
         path->Visible = b;
     }
@@ -685,6 +1296,7 @@ Scene::SetVisible(PathList path, bool b)
     FOR_EACH(p, path) {
         if ((*p)->Visible != b) {
             changed = true;
+            _TouchPath(*p);
             (*p)->Visible = b;
         }
     }
@@ -741,8 +1353,10 @@ Scene::_WalkPath(
     float arcTessLength,
     IndexList* pInds) const
 {
-    Vec2List vecs;
-    IndexList inds;
+    IndexList localInds;
+    IndexList& inds = pInds ? *pInds : localInds;
+    dest->clear();
+    inds.clear();
     if (path->Edges.empty()) {
         return;
     }
@@ -750,42 +1364,16 @@ Scene::_WalkPath(
     mat3 planeInverse = inverse(path->Plane->GetCoordSys());
     vec3 planeCenter = path->Plane->GetCenterPoint();
 
-    uvec2 previous = path->Edges.front()->Endpoints;
-    FOR_EACH(e, path->Edges) {
-
-        Arc* arc = dynamic_cast<Arc*>(*e);
-        if (arc) {
-            pezFatal("Arc walking isn't supported yet.");
-        }
-
-        // Edges can have inconsistent winding in our representation,
-        // so swap the two points if needed.
-        uvec2 xy = (*e)->Endpoints;
-        if (xy.x != previous.y) {
-            xy = uvec2(xy.y, xy.x);
-        }
-
-        // Poor man's way of returning only the outer path
-        // for paths that have holes.
-        if (xy.x != previous.x && xy.x != previous.y &&
-            xy.y != previous.x && xy.y != previous.y) {
-            break;
-        }
-        previous = xy;
-        vec3 v = _points[xy.x];
+    _WalkIndices(path, &inds);
+    dest->reserve(inds.size());
+    FOR_EACH(i, inds) {
+        vec3 v = _points[*i];
         VerifyPlane(v, path->Plane, "Faulty path plane in WalkPath.");
 
         // Convert to the coordinate system of the plane.
         vec3 planeOffset = planeInverse * (v - planeCenter);
         vec2 v2 = vec2(planeOffset.x, planeOffset.z);
-
-        vecs.push_back(v2);
-        inds.push_back(xy.x);
-    }
-
-    dest->swap(vecs);
-    if (pInds) {
-        pInds->swap(inds);
+        dest->push_back(v2);
     }
 }
 
@@ -797,33 +1385,57 @@ Scene::_WalkPath(const Path* path, Vec3List* dest, float arcTessLength) const
         return;
     }
 
-    uvec2 previous = path->Edges.front()->Endpoints;
-    FOR_EACH(e, path->Edges) {
+    IndexList inds;
+    _WalkIndices(path, &inds);
+    FOR_EACH(i, inds) {
+        vecs.push_back(_points[*i]);
+    }
+
+    dest->swap(vecs);
+}
 
-        Arc* arc = dynamic_cast<Arc*>(*e);
-        if (arc) {
+// Edges can have inconsistent winding in our representation, since
+// they are shared with adjoining paths, so each edge is oriented to
+// continue from its predecessor.  The direction of the first edge
+// decides whether we emit the leading or trailing point of each edge.
+void
+Scene::_WalkIndices(const Path* path, IndexList* dest) const
+{
+    IndexList& inds = *dest;
+    const EdgeList& edges = path->Edges;
+    inds.clear();
+
+    FOR_EACH(e, edges) {
+        if (IsArc(*e)) {
             pezFatal("Arc walking isn't supported yet.");
         }
+    }
 
-        // Edges can have inconsistent winding in our representation,
-        // so swap the two points if needed.
-        uvec2 xy = (*e)->Endpoints;
-        if (xy.x != previous.y) {
+    uvec2 first = edges.front()->Endpoints;
+    inds.push_back(first.y);
+    if (edges.size() < 2) {
+        return;
+    }
+
+    uvec2 second = edges[1]->Endpoints;
+    bool forward = first.y == second.x || first.y == second.y;
+    unsigned int tail = forward ? first.y : first.x;
+
+    for (size_t i = 1; i < edges.size(); ++i) {
+        uvec2 xy = edges[i]->Endpoints;
+        if (xy.y == tail) {
             xy = uvec2(xy.y, xy.x);
         }
 
         // Poor man's way of returning only the outer path
         // for paths that have holes.
-        if (xy.x != previous.x && xy.x != previous.y &&
-            xy.y != previous.x && xy.y != previous.y) {
+        if (xy.x != tail) {
             break;
         }
-        previous = xy;
-        vec3 v = _points[xy.x];
-        vecs.push_back(v);
-    }
 
-    dest->swap(vecs);
+        inds.push_back(forward ? xy.y : xy.x);
+        tail = xy.y;
+    }
 }
 
 void
@@ -861,7 +1473,7 @@ Scene::RotatePath(sketch::Path* path, vec3 axis, vec3 center, float theta)
     }
     FOR_EACH(p, points) {
         vec3 x = _points[*p];
-        _points[*p] = glm::rotate(x, theta, axis);
+        _MovePoint(*p, glm::rotate(x, theta, axis));
     }
 }
 
@@ -876,13 +1488,354 @@ Scene::ScalePath(sketch::Path* path, float scale, vec3 center)
     }
     FOR_EACH(p, points) {
         vec3 x = center + scale * (_points[*p] - center);
-        _points[*p] = x;
+        _MovePoint(*p, x);
     }
 
     if (_recording) {
-        appendJson(
-            _history,
-            "[ \"ScalePath\", \"%8.8x\", %f, %s]",
-            path, scale, toString(center) );
+        HistoryEntry& entry = _Record(HISTORY_SCALE_PATH, path);
+        entry.Width = scale;
+        entry.P = center;
+    }
+}
+
+Scene::HistoryEntry&
+Scene::_Record(HistoryOp op, const Path* path, const Path* outer)
+{
+    HistoryEntry entry = HistoryEntry();
+    entry.Op = op;
+    entry.Path = path;
+    entry.Outer = outer;
+    _historyLog.push_back(entry);
+    return _historyLog.back();
+}
+
+void
+Scene::_RecordPaths(HistoryEntry* entry, const PathList& paths)
+{
+    entry->FirstPath = _historyPaths.size();
+    entry->PathCount = paths.size();
+    _historyPaths.insert(_historyPaths.end(), paths.begin(), paths.end());
+}
+
+// Numbers and handles are formatted exactly as the history used to be
+// printed, so exported histories are unchanged.
+static Json::Value
+_HistoryNumber(float f)
+{
+    char text[64];
+    snprintf(text, sizeof(text), "%f", f);
+    return Json::Value(strtod(text, 0));
+}
+
+static Json::Value
+_HistoryVector(const float* v, int n)
+{
+    Json::Value vector(Json::arrayValue);
+    for (int i = 0; i < n; ++i) {
+        vector.append(_HistoryNumber(v[i]));
+    }
+    return vector;
+}
+
+static Json::Value
+_HistoryHandle(const Path* path)
+{
+    char text[16];
+    snprintf(text, sizeof(text), "%8.8x", (unsigned int) (size_t) path);
+    return Json::Value(text);
+}
+
+Json::Value
+Scene::_ExportHistoryEntry(const HistoryEntry& entry) const
+{
+    Json::Value handles(Json::arrayValue);
+    for (unsigned int i = 0; i < entry.PathCount; ++i) {
+        handles.append(_HistoryHandle(_historyPaths[entry.FirstPath + i]));
+    }
+
+    Json::Value node(Json::arrayValue);
+    switch (entry.Op) {
+    case HISTORY_ADD_QUAD:
+    case HISTORY_ADD_HOLE_QUAD:
+        node.append(entry.Op == HISTORY_ADD_QUAD ? "AddQuad" : "AddHoleQuad");
+        node.append(_HistoryHandle(entry.Path));
+        node.append(_HistoryVector(&entry.P.x, 3));
+        node.append(_HistoryVector(&entry.U.x, 3));
+        node.append(_HistoryVector(&entry.V.x, 3));
+        if (entry.Op == HISTORY_ADD_HOLE_QUAD) {
+            node.append(_HistoryHandle(entry.Outer));
+        }
+        break;
+    case HISTORY_ADD_RECTANGLE:
+        node.append("AddRectangle");
+        node.append(_HistoryHandle(entry.Path));
+        node.append(_HistoryNumber(entry.Width));
+        node.append(_HistoryNumber(entry.Height));
+        node.append(_HistoryVector(&entry.Eqn.x, 4));
+        node.append(_HistoryVector(&entry.Offset.x, 2));
+        break;
+    case HISTORY_ADD_POLYGON:
+        node.append("AddPolygon");
+        node.append(_HistoryHandle(entry.Path));
+        node.append(_HistoryNumber(entry.Width));
+        node.append(_HistoryVector(&entry.Eqn.x, 4));
+        node.append(_HistoryVector(&entry.Offset.x, 2));
+        node.append(entry.NumPoints);
+        break;
+    case HISTORY_ADD_INSCRIBED_RECTANGLE:
+    case HISTORY_ADD_HOLE_RECTANGLE:
+        node.append(entry.Op == HISTORY_ADD_HOLE_RECTANGLE ?
+                    "AddHoleRectangle" : "AddInscribedRectangle");
+        node.append(_HistoryHandle(entry.Path));
+        node.append(_HistoryNumber(entry.Width));
+        node.append(_HistoryNumber(entry.Height));
+        node.append(_HistoryHandle(entry.Outer));
+        node.append(_HistoryVector(&entry.Offset.x, 2));
+        break;
+    case HISTORY_ADD_INSCRIBED_POLYGON:
+        node.append("AddInscribedPolygon");
+        node.append(_HistoryHandle(entry.Path));
+        node.append(_HistoryNumber(entry.Width));
+        node.append(_HistoryHandle(entry.Outer));
+        node.append(_HistoryVector(&entry.Offset.x, 2));
+        node.append(entry.NumPoints);
+        break;
+    case HISTORY_PUSH_PATHS:
+        node.append("PushPaths");
+        node.append(handles);
+        node.append(_HistoryNumber(entry.Width));
+        break;
+    case HISTORY_PUSH_PATH:
+        node.append("PushPath");
+        node.append(_HistoryHandle(entry.Path));
+        node.append(_HistoryNumber(entry.Width));
+        node.append(handles);
+        break;
+    case HISTORY_SCALE_PATH:
+        node.append("ScalePath");
+        node.append(_HistoryHandle(entry.Path));
+        node.append(_HistoryNumber(entry.Width));
+        node.append(_HistoryVector(&entry.P.x, 3));
+        break;
+    }
+    return node;
+}
+
+const Json::Value&
+Scene::GetHistory() const
+{
+    for (; _historyExported < _historyLog.size(); ++_historyExported) {
+        _history.append(_ExportHistoryEntry(_historyLog[_historyExported]));
+    }
+    return _history;
+}
+
+static PathState
+_GetPathState(const CoplanarPath& path)
+{
+    PathState state;
+    state.Edges = path.Edges;
+    state.Holes = path.Holes;
+    state.Visible = path.Visible;
+    const CoplanarPath* cop = AsCoplanar(&path);
+    state.Plane = cop ? cop->Plane : 0;
+    return state;
+}
+
+static const PathList&
+_GetEdgeFaces(const Edge& edge)
+{
+    return edge.Faces;
+}
+
+void
+Scene::TakeSnapshot(SceneSnapshot* snapshot)
+{
+    snapshot->Owner = this;
+    _pointTracker.Capture(_points, &snapshot->Points);
+    _pathListTracker.Capture(_paths, &snapshot->Paths);
+    _holeListTracker.Capture(_holes, &snapshot->Holes);
+    _edgeListTracker.Capture(_edges, &snapshot->Edges);
+    _pathTracker.Capture(_pathObjects, _GetPathState, &snapshot->PathStates);
+    _edgeTracker.Capture(_edgeObjects, _GetEdgeFaces, &snapshot->EdgeFaces);
+    _planeTracker.Capture(_planes, PlaneStateGetter(this), &snapshot->PlaneStates);
+    snapshot->FreePlanes = _freePlanes;
+}
+
+// Copies the chunks that differ into a plain array of values.
+template<class T> static void
+_RestoreArray(
+    vector<T>& live,
+    ChunkTracker<T>& tracker,
+    const ChunkedArray<T>& src,
+    vector<size_t>& changed)
+{
+    tracker.Diff(src, &changed);
+    live.resize(src.Size);
+    FOR_EACH(c, changed) {
+        const vector<T>& chunk = *src.Chunks[*c];
+        std::copy(chunk.begin(), chunk.end(), live.begin() + *c * ChunkedArray<T>::ChunkSize);
+    }
+    tracker.Adopt(src, live.size());
+}
+
+// The topology hash is bumped rather than restored, since tessellators
+// cache their output by hash and the restored state is new to them.
+void
+Scene::RestoreSnapshot(const SceneSnapshot& snapshot)
+{
+    pezCheck(snapshot.Owner == this, "Snapshot was taken from another scene.");
+    _RestorePoints(snapshot.Points);
+    _RestoreEdges(snapshot.Edges);
+    _RestoreArray(_paths, _pathListTracker, snapshot.Paths, _changedChunks);
+    _RestoreArray(_holes, _holeListTracker, snapshot.Holes, _changedChunks);
+    _RestorePathStates(snapshot.PathStates);
+
+    const ChunkedArray<PathList>& faces = snapshot.EdgeFaces;
+    _edgeTracker.Diff(faces, &_changedChunks);
+    FOR_EACH(c, _changedChunks) {
+        const vector<PathList>& chunk = *faces.Chunks[*c];
+        size_t begin = *c * ChunkedArray<PathList>::ChunkSize;
+        for (size_t i = 0; i < chunk.size(); ++i) {
+            _edgeObjects[begin + i].Faces = chunk[i];
+        }
+    }
+    _edgeTracker.Adopt(faces, _edgeObjects.size());
+
+    _RestorePlanes(snapshot);
+    _topologyHash++;
+}
+
+void
+Scene::_RestorePoints(const ChunkedArray<vec3>& src)
+{
+    _pointTracker.Diff(src, &_changedChunks);
+    while (_points.size() > src.Size) {
+        _UnlinkPoint(_points.size() - 1);
+        _points.pop_back();
+    }
+    FOR_EACH(c, _changedChunks) {
+        const Vec3List& chunk = *src.Chunks[*c];
+        unsigned int begin = *c * ChunkedArray<vec3>::ChunkSize;
+        for (unsigned int i = begin; i < begin + chunk.size(); ++i) {
+            vec3 p = chunk[i - begin];
+            if (i < _points.size()) {
+                if (_points[i] != p) {
+                    _MovePoint(i, p);
+                }
+            } else {
+                _TouchPoint(i);
+                _points.push_back(p);
+                _pointGrid[_GetCell(p)].push_back(i);
+            }
+        }
+    }
+    _pointTracker.Adopt(src, _points.size());
+}
+
+void
+Scene::_RestoreEdges(const ChunkedArray<Edge*>& src)
+{
+    const size_t chunkSize = ChunkedArray<Edge*>::ChunkSize;
+    _edgeListTracker.Diff(src, &_changedChunks);
+
+    // Unmap the edges that are about to be overwritten or dropped.
+    for (size_t i = src.Size; i < _edges.size(); ++i) {
+        _UnmapEdge(_edges[i]);
+    }
+    FOR_EACH(c, _changedChunks) {
+        size_t end = std::min(_edges.size(), (*c + 1) * chunkSize);
+        for (size_t i = *c * chunkSize; i < end; ++i) {
+            _UnmapEdge(_edges[i]);
+        }
+    }
+
+    _edges.resize(src.Size);
+    FOR_EACH(c, _changedChunks) {
+        const EdgeList& chunk = *src.Chunks[*c];
+        size_t begin = *c * chunkSize;
+        for (size_t i = 0; i < chunk.size(); ++i) {
+            Edge* e = chunk[i];
+            _edges[begin + i] = e;
+            _edgeMap[_GetEdgeKey(e->Endpoints.x, e->Endpoints.y)] = e;
+        }
+    }
+    _edgeListTracker.Adopt(src, _edges.size());
+}
+
+void
+Scene::_UnmapEdge(Edge* edge)
+{
+    EdgeMap::iterator i = _edgeMap.find(_GetEdgeKey(edge->Endpoints.x, edge->Endpoints.y));
+    if (i != _edgeMap.end() && i->second == edge) {
+        _edgeMap.erase(i);
+    }
+}
+
+// Generations only ever increase, so tessellators and rigs never mistake
+// a restored path for a state that they have seen before.  Paths that are
+// created after a restore start over at generation zero, though, and can
+// land where a discarded path used to be in _paths; tessellators tell them
+// apart by Path::Index, which is never reused.
+void
+Scene::_RestorePathStates(const ChunkedArray<PathState>& src)
+{
+    _pathTracker.Diff(src, &_changedChunks);
+    FOR_EACH(c, _changedChunks) {
+        const vector<PathState>& chunk = *src.Chunks[*c];
+        size_t begin = *c * ChunkedArray<PathState>::ChunkSize;
+        for (size_t i = 0; i < chunk.size(); ++i) {
+            Path* path = &_pathObjects[begin + i];
+            const PathState& state = chunk[i];
+            if (path->Edges != state.Edges || path->Holes != state.Holes) {
+                path->Edges = state.Edges;
+                path->Holes = state.Holes;
+                path->Generation++;
+            }
+            path->Visible = state.Visible;
+            CoplanarPath* cop = AsCoplanar(path);
+            if (cop) {
+                cop->Plane = state.Plane;
+            }
+        }
+    }
+    _pathTracker.Adopt(src, _pathObjects.size());
+}
+
+// Planes that were created after the snapshot was taken are unreachable
+// once it's restored, so they go back to the free list.
+void
+Scene::_RestorePlanes(const SceneSnapshot& snapshot)
+{
+    const ChunkedArray<PlaneState>& src = snapshot.PlaneStates;
+    _planeTracker.Diff(src, &_changedChunks);
+
+    _freePlanes = snapshot.FreePlanes;
+    for (size_t i = src.Size; i < _planes.size(); ++i) {
+        Plane* plane = _planes[i];
+        _UnmapPlane(plane);
+        plane->RefCount = 0;
+        _freePlanes.push_back(plane);
+    }
+
+    FOR_EACH(c, _changedChunks) {
+        const vector<PlaneState>& chunk = *src.Chunks[*c];
+        size_t begin = *c * ChunkedArray<PlaneState>::ChunkSize;
+        for (size_t i = 0; i < chunk.size(); ++i) {
+            _UnmapPlane(_planes[begin + i]);
+        }
+    }
+    FOR_EACH(c, _changedChunks) {
+        const vector<PlaneState>& chunk = *src.Chunks[*c];
+        size_t begin = *c * ChunkedArray<PlaneState>::ChunkSize;
+        for (size_t i = 0; i < chunk.size(); ++i) {
+            Plane* plane = _planes[begin + i];
+            plane->Eqn = chunk[i].Eqn;
+            plane->RefCount = chunk[i].RefCount;
+            if (chunk[i].Mapped) {
+                _planeMap.insert(PlaneMap::value_type(_GetPlaneKey(plane->Eqn), plane));
+            }
+        }
     }
+    _planeTracker.Adopt(src, _planes.size());
 }
@@ -1,7 +1,10 @@
 #pragma once
+#include "common/sketchArena.h"
+#include "common/sketchSnapshot.h"
 #include "common/typedefs.h"
 #include "glm/glm.hpp"
 #include "jsoncpp/json.h"
+#include <unordered_map>
 
 namespace sketch
 {
@@ -10,6 +13,7 @@ namespace sketch
     // take care to never create them from scratch or modify them directly.
     // See sketch::Scene for the actual interface.
 
+    class Scene;
     class Tessellator;
     struct Path;
     struct Edge;
@@ -24,17 +28,38 @@ namespace sketch
     struct Plane
     {
         glm::vec4 Eqn;
+        unsigned int RefCount;
+        unsigned int Index;
         glm::vec3 GetNormal() const { return glm::vec3(Eqn); }
         glm::mat3 GetCoordSys() const;
         glm::vec3 GetCenterPoint() const;
     };
 
+    // Type tags let per-frame code avoid dynamic_cast; see AsCoplanar and IsArc.
+    enum PathType {
+        GENERAL_PATH,
+        COPLANAR_PATH,
+    };
+
+    enum EdgeType {
+        LINE_EDGE,
+        ARC_EDGE,
+    };
+
     // Closed path in 3-space consisting of arcs and line segments.  Cannot self-intersect.
     struct Path
     {
+        Path() : Type(GENERAL_PATH), Generation(0), Index(0) {}
         EdgeList Edges;
         PathList Holes;
         bool Visible;
+        PathType Type;
+
+        // Bumped whenever the path's edges or holes change.
+        unsigned int Generation;
+
+        // Position among all the paths that the scene has ever created.
+        unsigned int Index;
         virtual ~Path() {}
     };
 
@@ -42,6 +67,7 @@ namespace sketch
     // to create non-coplanar paths is via arc extrusion.
     struct CoplanarPath : Path
     {
+        CoplanarPath() : Plane(0) { Type = COPLANAR_PATH; }
         sketch::Plane* Plane;
         glm::vec3 GetNormal() const { return Plane->GetNormal(); }
     };
@@ -51,8 +77,11 @@ namespace sketch
     // are shared with adjoining paths.
     struct Edge
     {
+        Edge() : Type(LINE_EDGE), Index(0) {}
         glm::uvec2 Endpoints;
         PathList Faces;
+        EdgeType Type;
+        unsigned int Index;
         virtual ~Edge() {}
     };
 
@@ -60,10 +89,30 @@ namespace sketch
     // of the edge the arc lies on.  Arcs cannot be greater than 180 degrees.
     struct Arc : Edge
     {
+        Arc() { Type = ARC_EDGE; }
         float Radius;
         sketch::Plane* Plane;
     };
 
+    // Returns null if the given path is not coplanar.
+    inline CoplanarPath*
+    AsCoplanar(Path* path)
+    {
+        return path->Type == COPLANAR_PATH ? static_cast<CoplanarPath*>(path) : 0;
+    }
+
+    inline const CoplanarPath*
+    AsCoplanar(const Path* path)
+    {
+        return path->Type == COPLANAR_PATH ? static_cast<const CoplanarPath*>(path) : 0;
+    }
+
+    inline bool
+    IsArc(const Edge* edge)
+    {
+        return edge->Type == ARC_EDGE;
+    }
+
     // Orientable rectangle in 3-space define by a point and two vectors:
     // p ... center point
     // u ... half-width vector
@@ -74,12 +123,98 @@ namespace sketch
         glm::vec3 v;
     };
 
+    // Points that move when an existing extrusion slides along its normal.
+    // See Scene::RigExtrusion; a rig is only valid until the path's edges change.
+    struct ExtrusionRig
+    {
+        ExtrusionRig() : Path(0), Generation(0) {}
+        CoplanarPath* Path;
+        IndexList Points;
+        unsigned int Generation;
+    };
+
     enum ExtrusionVisibility {
         DEFAULT,
         HIDE,
         SHOW,
     };
 
+    // Hashes the integer coordinates of a cell in a uniform grid.
+    struct CellHash
+    {
+        size_t operator()(const glm::ivec3& c) const
+        {
+            return (unsigned(c.x) * 73856093u) ^
+                   (unsigned(c.y) * 19349663u) ^
+                   (unsigned(c.z) * 83492791u);
+        }
+    };
+
+    // Maps grid cells to the indices of the points that lie within them.
+    typedef std::unordered_map<glm::ivec3, IndexList, CellHash> PointGrid;
+
+    // Hashes an edge key; see Scene::_GetEdgeKey.
+    struct EdgeKeyHash
+    {
+        size_t operator()(const glm::uvec2& k) const
+        {
+            return k.x * 2654435761u ^ k.y;
+        }
+    };
+
+    // Maps unordered pairs of endpoints to the edge that joins them.
+    typedef std::unordered_map<glm::uvec2, Edge*, EdgeKeyHash> EdgeMap;
+
+    // Hashes a plane equation that has been quantized to integers.
+    struct PlaneKeyHash
+    {
+        size_t operator()(const glm::ivec4& k) const
+        {
+            return (unsigned(k.x) * 73856093u) ^
+                   (unsigned(k.y) * 19349663u) ^
+                   (unsigned(k.z) * 83492791u) ^
+                   (unsigned(k.w) * 2654435761u);
+        }
+    };
+
+    // Maps quantized plane equations to their interned planes.
+    typedef std::unordered_map<glm::ivec4, Plane*, PlaneKeyHash> PlaneMap;
+
+    // Mutable parts of a path, as saved in a SceneSnapshot.
+    struct PathState
+    {
+        EdgeList Edges;
+        PathList Holes;
+        bool Visible;
+        sketch::Plane* Plane;
+    };
+
+    // Ditto, but for a plane.  Mapped is true if the plane wins its slot in
+    // the plane map; see Scene::_InternPlane.
+    struct PlaneState
+    {
+        glm::vec4 Eqn;
+        unsigned int RefCount;
+        bool Mapped;
+    };
+
+    // Saved state of a Scene; see Scene::TakeSnapshot.  Snapshots share all
+    // unchanged chunks with each other, so they are cheap to take and keep.
+    // A snapshot can only be restored into the scene that took it.
+    struct SceneSnapshot
+    {
+        SceneSnapshot() : Owner(0) {}
+        const Scene* Owner;
+        ChunkedArray<glm::vec3> Points;
+        ChunkedArray<Path*> Paths;
+        ChunkedArray<Path*> Holes;
+        ChunkedArray<Edge*> Edges;
+        ChunkedArray<PathState> PathStates;
+        ChunkedArray<PathList> EdgeFaces;
+        ChunkedArray<PlaneState> PlaneStates;
+        PlaneList FreePlanes;
+    };
+
     // Presents an interface to the outside world for the 'sketch' subsystem.
     class Scene
     {
@@ -118,7 +253,20 @@ namespace sketch
 
         // Ditto, but for multiple paths.
         void
-        SetPathPlanes(PathList paths, FloatList ws);
+        SetPathPlanes(const PathList& paths, const FloatList& ws);
+
+        // Capture the points that SetPathPlane would move for an existing extrusion.
+        // Useful for per-frame animation, since it avoids re-scanning the adjoining faces.
+        void
+        RigExtrusion(CoplanarPath* path, ExtrusionRig* rig) const;
+
+        // Equivalent to SetPathPlane, but only touches the points in the rig.
+        void
+        SetRigPlane(const ExtrusionRig& rig, float w);
+
+        // Ditto, but for an array of rigs; ws holds one plane offset per rig.
+        void
+        SetRigPlanes(const ExtrusionRig* rigs, const float* ws, size_t count);
 
         // Inscribe a path and create a hole in the outer path.
         CoplanarPath*
@@ -160,6 +308,18 @@ namespace sketch
         void
         ScalePath(sketch::Path* path, float scale, glm::vec3 center);
 
+        // Save the points and topology of the scene.  Only the chunks that
+        // changed since the previous snapshot (or restore) are copied.
+        void
+        TakeSnapshot(SceneSnapshot* snapshot);
+
+        // Return to an earlier (or later) snapshot, copying only the chunks
+        // that differ from the current state.  Paths whose edges or holes
+        // change get a new generation, so rigs on those paths must be
+        // captured again.  The recorded history is left alone.
+        void
+        RestoreSnapshot(const SceneSnapshot& snapshot);
+
         Scene();
         ~Scene();
 
@@ -168,15 +328,75 @@ namespace sketch
         void
         EnableHistory(bool b) { _recording = b; }
 
+        // Mutations are logged in a compact form while history is enabled; this
+        // converts the entries logged since the previous call, and returns the
+        // whole history as a JSON array of [method name, arguments...].
         const Json::Value &
-        GetHistory() const { return _history; }
+        GetHistory() const;
 
         Json::Value
         Serialize() const;
 
+        // Append a compact binary image of the scene to the given blob.  The image
+        // consists of fixed-size records in native byte order, which are copied
+        // into the scene's own containers on load.  Path indices are preserved;
+        // clients can save Path::Index as a handle and use GetPath after loading.
+        void
+        WriteBinary(Blob* dest) const;
+
+        // Load a binary image into a freshly constructed scene, starting at the
+        // given byte offset.  Returns the offset just past the image, or zero,
+        // leaving the scene empty, if the image is truncated or damaged.
+        size_t
+        ReadBinary(const Blob& src, size_t offset = 0);
+
+        // Ditto, but for a raw pointer to the image.  Returns its size in bytes,
+        // or zero.
+        size_t
+        ReadBinary(const void* src, size_t size);
+
+        Path*
+        GetPath(unsigned int index) const { return &_pathObjects[index]; }
+
+        // One past the largest index that GetPath accepts.
+        size_t
+        GetPathCount() const { return _pathObjects.size(); }
+
         unsigned int
         GetTopologyHash() const { return _topologyHash; }
 
+        // Appends the ranges of points that were added or moved since the
+        // given stamp as [begin, end) pairs, and returns the stamp to pass
+        // next time.  Pass zero to get every point.  Points are tracked in
+        // blocks, so the ranges may include some unchanged neighbors.
+        unsigned int
+        GetChangedPoints(unsigned int since, std::vector<glm::uvec2>* ranges) const;
+
+        // Number of edge comparisons that the edge map has saved us from,
+        // relative to scanning all existing edges for every new edge.
+        unsigned long
+        GetEdgeLookupsAvoided() const { return _edgeLookupsAvoided; }
+
+        // Planes are interned and recycled once no path refers to them,
+        // so the number of allocated planes should stay close to the
+        // number of live planes, even during long animations.
+        size_t
+        GetLivePlaneCount() const { return _planes.size() - _freePlanes.size(); }
+
+        size_t
+        GetAllocatedPlaneCount() const { return _planes.size(); }
+
+        // Paths, edges and planes live in a per-scene arena; see sketch::Arena
+        // for process-wide statistics.
+        size_t
+        GetArenaBytes() const { return _arena.GetBytesUsed(); }
+
+        // When enabled, new points are welded with a brute-force scan rather
+        // than through the point grid.  Both give the same indices; the scan
+        // is only kept for comparison.  Affects every scene.
+        static void
+        EnableLinearWelding(bool enabled);
+
         void
         SetVisible(Path* path, bool b);
 
@@ -235,6 +455,10 @@ namespace sketch
         void
         _AppendEdge(Path* path, Edge* e);
 
+        // Order-independent key for the edge between two points.
+        static glm::uvec2
+        _GetEdgeKey(unsigned int a, unsigned int b) { return a < b ? glm::uvec2(a, b) : glm::uvec2(b, a); }
+
         // Create a new point and return its index.
         unsigned int
         _AppendPoint(glm::vec3 p);
@@ -243,6 +467,104 @@ namespace sketch
         unsigned int
         _AppendPoint(float x, float y, float z)  { return _AppendPoint(glm::vec3(x, y, z)); }
 
+        // Returns the lowest index of a point within welding distance, or -1.
+        int
+        _FindPoint(glm::vec3 p) const;
+
+        // Relocate an existing point and keep the point grid up to date.
+        void
+        _MovePoint(unsigned int i, glm::vec3 p);
+
+        glm::ivec3
+        _GetCell(glm::vec3 p) const;
+
+        // Remove a point from the point grid without touching _points.
+        void
+        _UnlinkPoint(unsigned int i);
+
+        // Create a visible coplanar path with no edges.
+        CoplanarPath*
+        _NewPath();
+
+        // Add a hole to the given path and to the scene's list of holes.
+        void
+        _AddHole(CoplanarPath* outer, CoplanarPath* hole);
+
+        // Let the snapshot trackers know that an object is about to change.
+        // Points are also stamped for GetChangedPoints.
+        void
+        _TouchPoint(unsigned int i);
+
+        void
+        _TouchPath(Path* path) { _pathTracker.Touch(path->Index); }
+
+        void
+        _TouchEdge(Edge* edge) { _edgeTracker.Touch(edge->Index); }
+
+        void
+        _TouchPlane(Plane* plane) { _planeTracker.Touch(plane->Index); }
+
+        void
+        _RestorePoints(const ChunkedArray<glm::vec3>& src);
+
+        void
+        _RestoreEdges(const ChunkedArray<Edge*>& src);
+
+        void
+        _RestorePathStates(const ChunkedArray<PathState>& src);
+
+        void
+        _RestorePlanes(const SceneSnapshot& src);
+
+        // Remove an edge from the edge map if it owns its slot.
+        void
+        _UnmapEdge(Edge* edge);
+
+        // Saves the state of a plane, including whether it owns its slot.
+        struct PlaneStateGetter;
+
+        // Scene methods that appear in the history.
+        enum HistoryOp {
+            HISTORY_ADD_QUAD,
+            HISTORY_ADD_RECTANGLE,
+            HISTORY_ADD_POLYGON,
+            HISTORY_ADD_INSCRIBED_RECTANGLE,
+            HISTORY_ADD_HOLE_RECTANGLE,
+            HISTORY_ADD_HOLE_QUAD,
+            HISTORY_ADD_INSCRIBED_POLYGON,
+            HISTORY_PUSH_PATHS,
+            HISTORY_PUSH_PATH,
+            HISTORY_SCALE_PATH,
+        };
+
+        // One call to a Scene method, with the arguments that are exported by
+        // GetHistory.  Each entry only uses the fields its method takes.
+        struct HistoryEntry
+        {
+            HistoryOp Op;
+            const sketch::Path* Path;     // path that was created or changed
+            const sketch::Path* Outer;    // path that an inscribed path went in
+            float Width;                  // or the radius, delta, or scale
+            float Height;
+            int NumPoints;
+            glm::vec4 Eqn;
+            glm::vec2 Offset;
+            glm::vec3 P, U, V;            // quads, or the center of a scale in P
+            unsigned int FirstPath;       // into _historyPaths: the paths of
+            unsigned int PathCount;       // PushPaths, or the walls of PushPath
+        };
+
+        // Appends a zeroed entry to the history log.
+        HistoryEntry&
+        _Record(HistoryOp op, const Path* path, const Path* outer = 0);
+
+        // Stores a list of handles for the given entry.
+        void
+        _RecordPaths(HistoryEntry* entry, const PathList& paths);
+
+        Json::Value
+        _ExportHistoryEntry(const HistoryEntry& entry) const;
+
         // Returns true if the two paths meet at the given edge at ninety degrees.
         bool
         _IsOrthogonal(const CoplanarPath* p1, const Path* p2, const Edge* e);
@@ -256,11 +578,39 @@ namespace sketch
         sketch::Plane*
         _GetPlane(glm::vec3 p, glm::vec3 u, glm::vec3 v);
 
+        // Returns an existing plane within _threshold of the given
+        // (canonicalized) equation, or creates a new one.
+        sketch::Plane*
+        _InternPlane(glm::vec4 eqn);
+
+        // Create or recycle a plane, without looking for an existing one.
+        sketch::Plane*
+        _AllocPlane(glm::vec4 eqn);
+
+        glm::ivec4
+        _GetPlaneKey(glm::vec4 eqn) const;
+
+        // Point the given path at a new plane, updating reference counts.
+        void
+        _SetPathPlane(CoplanarPath* path, const sketch::Plane* plane);
+
+        // Move a path to a new plane equation; the path's current plane is
+        // modified in-place if nobody else refers to it.
+        void
+        _MovePathPlane(CoplanarPath* path, glm::vec4 eqn);
+
+        void
+        _ReleasePlane(sketch::Plane* plane);
+
+        void
+        _UnmapPlane(sketch::Plane* plane);
+
         // Break up the path into a line strip and return the resulting point list.
         void
         _WalkPath(const Path* src, Vec3List* dest, float arcTessLength = 0) const;
 
-        // Ditto, but in the coordinate space of the path.
+        // Ditto, but in the coordinate space of the path.  The destination
+        // lists are overwritten in place so callers can recycle them.
         void
         _WalkPath(
             const CoplanarPath* src,
@@ -268,18 +618,60 @@ namespace sketch
             float arcTessLength = 0,
             IndexList* pInds = 0) const;
 
+        // Ditto, but returns point indices rather than positions.
+        void
+        _WalkIndices(const Path* src, IndexList* dest) const;
+
         void
         _VerifyPlane(const CoplanarPath* path, const char* msg) const;
 
+        Arena _arena;
+
+        // Every path and edge that was ever created, even those that are
+        // unreachable since restoring a snapshot.  Never shrinks.  Objects
+        // are stored by value, indexed by Path::Index and Edge::Index, so
+        // walking them touches contiguous memory.  General paths are kept
+        // as CoplanarPath records with no plane; arcs aren't stored yet.
+        HandleArray<CoplanarPath> _pathObjects;
+        HandleArray<Edge> _edgeObjects;
+
         PathList _paths;
         PathList _holes;
         EdgeList _edges;
+        EdgeMap _edgeMap;
         Vec3List _points;
         PlaneList _planes;
+        PlaneList _freePlanes;
+        PlaneMap _planeMap;
         const float _threshold;
-        Json::Value _history;
+        const float _cellSize;
+        PointGrid _pointGrid;
+
+        // Scratch space for SetRigPlanes; _rigOffsets is all zeros between calls.
+        Vec3List _rigOffsets;
+        IndexList _rigPoints;
+
+        // Copy-on-write bookkeeping for snapshots; see SceneSnapshot.
+        ChunkTracker<glm::vec3> _pointTracker;
+        ChunkTracker<Path*> _pathListTracker;
+        ChunkTracker<Path*> _holeListTracker;
+        ChunkTracker<Edge*> _edgeListTracker;
+        ChunkTracker<PathState> _pathTracker;
+        ChunkTracker<PathList> _edgeTracker;
+        ChunkTracker<PlaneState> _planeTracker;
+        std::vector<size_t> _changedChunks;
+
+        // Stamp of the most recent change to each block of points.
+        std::vector<unsigned int> _pointStamps;
+        mutable unsigned int _pointStamp;
+
+        std::vector<HistoryEntry> _historyLog;
+        ConstPathList _historyPaths;
+        mutable Json::Value _history;
+        mutable size_t _historyExported;
         bool _recording;
         unsigned int _topologyHash;
+        unsigned long _edgeLookupsAvoided;
 
         friend class Tessellator;
     };
@@ -0,0 +1,100 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace sketch
+{
+    // Array that has been saved in fixed-size, immutable chunks.  Chunks that
+    // did not change between two snapshots are shared rather than copied.
+    template<class T>
+    struct ChunkedArray
+    {
+        typedef std::vector<T> Chunk;
+        typedef std::shared_ptr<const Chunk> ChunkPtr;
+        enum { ChunkSize = 256 };
+
+        ChunkedArray() : Size(0) {}
+        std::vector<ChunkPtr> Chunks;
+        size_t Size;
+    };
+
+    // Remembers which chunks of a live array are still identical to a chunk
+    // that was handed out to a snapshot.  Until the first capture, Touch is
+    // a no-op, so scenes that never take snapshots pay next to nothing.
+    template<class T>
+    class ChunkTracker
+    {
+    public:
+        typedef ChunkedArray<T> Array;
+        typedef typename Array::Chunk Chunk;
+        typedef typename Array::ChunkPtr ChunkPtr;
+
+        // Call whenever element i is modified or appended.
+        void Touch(size_t i)
+        {
+            size_t c = i / Array::ChunkSize;
+            if (c < _shared.size()) {
+                _shared[c].reset();
+            }
+        }
+
+        // Copies the chunks that changed since the last capture or restore.
+        void Capture(const std::vector<T>& live, Array* dest)
+        {
+            Capture(live, _Identity, dest);
+        }
+
+        // Ditto, but the saved elements are derived from the live ones, which
+        // can be in any container with size() and operator[].
+        template<class Live, class Getter>
+        void Capture(const Live& live, const Getter& get, Array* dest)
+        {
+            size_t count = (live.size() + Array::ChunkSize - 1) / Array::ChunkSize;
+            _shared.resize(count);
+            for (size_t c = 0; c < count; ++c) {
+                if (_shared[c]) {
+                    continue;
+                }
+                size_t begin = c * Array::ChunkSize;
+                size_t end = std::min(live.size(), begin + Array::ChunkSize);
+                Chunk* chunk = new Chunk();
+                chunk->reserve(end - begin);
+                for (size_t i = begin; i < end; ++i) {
+                    chunk->push_back(get(live[i]));
+                }
+                _shared[c].reset(chunk);
+            }
+            dest->Chunks = _shared;
+            dest->Size = live.size();
+        }
+
+        // Returns the indices of the chunks that differ from a saved array;
+        // the caller copies those into the live array, then calls Adopt.
+        void Diff(const Array& src, std::vector<size_t>* changed) const
+        {
+            changed->clear();
+            for (size_t c = 0; c < src.Chunks.size(); ++c) {
+                if (c >= _shared.size() || _shared[c] != src.Chunks[c]) {
+                    changed->push_back(c);
+                }
+            }
+        }
+
+        // Marks the live array as identical to the saved one.  The live array
+        // may have kept elements past the end of the saved one.
+        void Adopt(const Array& src, size_t liveSize)
+        {
+            _shared = src.Chunks;
+            if (liveSize > src.Size) {
+                Touch(src.Size);
+            }
+        }
+
+    private:
+        static const T& _Identity(const T& t) { return t; }
+
+        std::vector<ChunkPtr> _shared;
+    };
+}
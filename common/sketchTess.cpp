@@ -3,19 +3,91 @@
 #include "common/sketchTess.h"
 #include "common/init.h"
 #include "common/vao.h"
-#include <list>
+#include "common/vertexCacheUtil.h"
+#include "common/workerPool.h"
+#include "tthread/tinythread.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
 
 using namespace sketch;
 using namespace glm;
 using namespace std;
 
+// Fanning out costs a wake-up of every worker, which isn't worth it for
+// the handful of paths that change during a typical animation frame.
+static const size_t MinParallelPaths = 64;
+
+// Outlines are compared after snapping their points to this grid, relative
+// to the first point of the rim.
+static const double ShapeQuantum = 1.0 / 1024.0;
+
+// Corners flatter than this (the sine of the turn) don't count as convex.
+static const double ConvexTolerance = 1e-6;
+
+// Rectangle corners may be off by this fraction of its half-perimeter.
+static const float RectTolerance = 1e-4f;
+
+// Facet vertices are compared against the previous push in blocks of this
+// many, to find the ranges that need uploading.
+static const size_t FacetBlockSize = 32;
+
+// Facets shorter than this get fewer window rows, and facets wider than
+// this get more window columns.
+static const float ShortFacet = 10.0f;
+static const float WideFacet = 50.0f;
+
+// Meshes with fewer vertices than this are drawn with 16-bit indices.
+static const size_t MaxShortIndexVertices = 65536;
+
+struct ShapeKeyHash
+{
+    size_t operator()(const vector<int>& key) const
+    {
+        size_t hash = 2166136261u;
+        FOR_EACH(k, key) {
+            hash = (hash ^ unsigned(*k)) * 16777619u;
+        }
+        return hash;
+    }
+};
+
+// Maps shape keys to triangles whose corners index into the pooled points
+// of the outline: first the rim, then each hole in turn.
+typedef unordered_map<vector<int>, TriList, ShapeKeyHash> ShapeCache;
+
+// Shared by every tessellator in the process, including the ones that run
+// on pool workers.  Once it holds MaxShapeCacheEntries shapes, it's emptied
+// before the next one goes in, so that a demo that sketches a fresh city in
+// every shot doesn't keep the outlines of all the previous ones around.
+static const size_t MaxShapeCacheEntries = 8192;
+static ShapeCache _shapeCache;
+static tthread::mutex _shapeCacheMutex;
+static bool _shapeCaching = true;
+static size_t _shapeCacheHits = 0;
+static size_t _shapeCacheMisses = 0;
+
+const VertexAttribMask Tessellator::FacetAttribs =
+    AttrPositionFlag | AttrNormalFlag | AttrTexCoordFlag | AttrFacetFlag;
+
 Tessellator::Tessellator(const sketch::Scene& scene) :
-    _scene(&scene)
+    _scene(&scene),
+    _parallel(false),
+    _facets(DefaultFacets),
+    _cacheOptimization(false),
+    _acmrBefore(0),
+    _acmrAfter(0)
 {
     _topologyHashPushToGpu = 0;
+    _pointStampPushToGpu = 0;
+    _gpuVertexCapacity = 0;
     _topologyHashDelaunay = 0;
 }
 
+// Only paths whose generation has changed since the previous call are
+// re-triangulated; everybody else's triangles are copied over as-is.
+// Dirty paths are triangulated into per-participant buffers first, then
+// everything is stitched together in path order.
 void
 sketch::Tessellator::PullFromScene()
 {
@@ -23,107 +95,672 @@ sketch::Tessellator::PullFromScene()
         return;
     }
 
-    _tris.clear();
+    const PathList& paths = _scene->_paths;
+    size_t previousCount = _ranges.size();
+    _ranges.resize(paths.size());
 
-    float arcTessLength = 0;
-    
-    FOR_EACH(p, _scene->_paths) {
+    _dirty.clear();
+    _nextHoleStates.clear();
+    for (size_t i = 0; i < paths.size(); ++i) {
+        const Path* path = paths[i];
+        PathRange& range = _ranges[i];
+        PathState state = _GetState(path);
 
-        CoplanarPath* coplanar = dynamic_cast<CoplanarPath*>(*p);
-        pezCheck(coplanar != NULL, "Holes are not supported in non-coplanar paths.");
+        bool clean = i < previousCount &&
+            range.State == state &&
+            range.HoleCount == path->Holes.size();
+        for (size_t h = 0; clean && h < range.HoleCount; ++h) {
+            clean = _holeStates[range.FirstHole + h] == _GetState(path->Holes[h]);
+        }
 
-        if (not coplanar->Visible) {
+        range.State = state;
+        range.FirstHole = _nextHoleStates.size();
+        range.HoleCount = path->Holes.size();
+        FOR_EACH(h, path->Holes) {
+            _nextHoleStates.push_back(_GetState(*h));
+        }
+        if (clean) {
             continue;
         }
 
-        Vec2List rim2d;
-        IndexList indices;
-        _scene->_WalkPath(coplanar, &rim2d, arcTessLength, &indices);
+        pezCheck(AsCoplanar(path) != NULL, "Holes are not supported in non-coplanar paths.");
+        DirtyPath dirty = { i, 0, TESS_NONE, 0, 0 };
+        _dirty.push_back(dirty);
+    }
+    _holeStates.swap(_nextHoleStates);
 
-        if (rim2d.size() == 3) {
-            _tris.push_back(ivec3(indices[0],indices[1], indices[2]));
-            continue;
+    unsigned int participants = 1;
+    if (_parallel && _dirty.size() >= MinParallelPaths) {
+        participants = WorkerPool::GetInstance().GetParticipantCount();
+    }
+    if (_participantTris.size() < participants) {
+        _participantTris.resize(participants);
+    }
+    for (unsigned int p = 0; p < participants; ++p) {
+        _participantTris[p].clear();
+    }
+
+    if (participants > 1) {
+        WorkerPool::GetInstance().Run(_TriangulateJob, this);
+    } else {
+        _TriangulateDirty(0, 1, &_scratch);
+    }
+
+    TriList& tris = _nextTris;
+    tris.clear();
+    tris.reserve(_tris.size());
+    DirtyPaths::const_iterator dirty = _dirty.begin();
+    for (size_t i = 0; i < paths.size(); ++i) {
+        PathRange& range = _ranges[i];
+        size_t offset = tris.size();
+
+        if (dirty != _dirty.end() && dirty->Path == i) {
+            TriList::const_iterator first =
+                _participantTris[dirty->Participant].begin() + dirty->Offset;
+            tris.insert(tris.end(), first, first + dirty->Count);
+            range.Method = dirty->Method;
+            ++dirty;
+        } else {
+            TriList::const_iterator first = _tris.begin() + range.Offset;
+            tris.insert(tris.end(), first, first + range.Count);
         }
 
-        if (rim2d.size() < 3) {
-            continue;
+        range.Offset = offset;
+        range.Count = tris.size() - offset;
+    }
+
+    _tris.swap(tris);
+    _topologyHashDelaunay = _scene->GetTopologyHash();
+}
+
+void
+sketch::Tessellator::_TriangulateDirty(
+    unsigned int participant,
+    unsigned int stride,
+    Scratch* scratch)
+{
+    TriList& tris = _participantTris[participant];
+    for (size_t d = participant; d < _dirty.size(); d += stride) {
+        DirtyPath& dirty = _dirty[d];
+        const CoplanarPath* coplanar = AsCoplanar(_scene->_paths[dirty.Path]);
+        dirty.Participant = participant;
+        dirty.Offset = tris.size();
+        dirty.Method = TESS_NONE;
+        if (coplanar->Visible) {
+            dirty.Method = _TriangulatePath(coplanar, scratch, &tris);
         }
+        dirty.Count = tris.size() - dirty.Offset;
+    }
+}
+
+// Dirty paths are dealt out round-robin, which spreads clusters of
+// expensive paths (say, a wall full of windows) across all participants.
+void
+sketch::Tessellator::_TriangulateJob(void* arg, unsigned int participant)
+{
+    Tessellator* tess = (Tessellator*) arg;
+    unsigned int stride = WorkerPool::GetInstance().GetParticipantCount();
+    tess->_TriangulateDirty(participant, stride, _GetPoolScratch(participant));
+}
+
+// The pool runs one job at a time, so every tessellator can share a single
+// scratch context per participant.
+sketch::Tessellator::Scratch*
+sketch::Tessellator::_GetPoolScratch(unsigned int participant)
+{
+    static vector<Scratch> scratch(WorkerPool::GetInstance().GetParticipantCount());
+    return &scratch[participant];
+}
+
+sketch::Tessellator::PathState
+sketch::Tessellator::_GetState(const Path* path)
+{
+    PathState state = { path->Index, path->Generation, path->Visible };
+    return state;
+}
+
+bool
+sketch::Tessellator::PathState::operator==(const PathState& other) const
+{
+    return Index == other.Index &&
+        Generation == other.Generation &&
+        Visible == other.Visible;
+}
+
+// Copies a walked path into the point pool.  Pool entries are recycled
+// rather than destroyed so that their edge lists keep their capacity.
+void
+sketch::Tessellator::_AppendPoints(
+    const Vec2List& coords,
+    const IndexList& indices,
+    size_t* count,
+    Scratch* scratch)
+{
+    TessPoints& points = scratch->Points;
+    if (points.size() < *count + coords.size()) {
+        points.resize(*count + coords.size());
+    }
+    for (size_t i = 0; i < coords.size(); ++i) {
+        TessPoint& p = points[(*count)++];
+        p.set(coords[i].x, coords[i].y);
+        p.edge_list.clear();
+        p.Index = indices[i];
+    }
+}
+
+// Snaps the pooled points to the cache grid and builds the cache key, which
+// lists the ring sizes followed by the snapped coordinates.  Triangulating
+// the snapped points rather than the originals makes every template depend
+// on its key alone, so the output doesn't depend on which copy of a shape
+// happened to be triangulated first, even when running on the pool.
+//
+// Returns false, leaving the points alone, if snapping would merge any two
+// points of the outline or its holes; those shapes bypass the cache.
+bool
+sketch::Tessellator::_SnapShape(size_t count, size_t rimCount, Scratch* scratch)
+{
+    TessPoints& points = scratch->Points;
+    vector<int>& key = scratch->ShapeKey;
+    key.clear();
+    key.push_back(rimCount);
+    key.push_back(scratch->HoleEnds.size());
+    FOR_EACH(holeEnd, scratch->HoleEnds) {
+        key.push_back(*holeEnd);
+    }
+
+    size_t header = key.size();
+    double x0 = points[0].x;
+    double y0 = points[0].y;
+    for (size_t i = 0; i < count; ++i) {
+        key.push_back((int) floor((points[i].x - x0) / ShapeQuantum + 0.5));
+        key.push_back((int) floor((points[i].y - y0) / ShapeQuantum + 0.5));
+    }
+
+    const int* snapped = &key[header];
+    vector<pair<int, int> >& sorted = scratch->SnappedPoints;
+    sorted.clear();
+    for (size_t i = 0; i < count; ++i) {
+        sorted.push_back(make_pair(snapped[i * 2], snapped[i * 2 + 1]));
+    }
+    sort(sorted.begin(), sorted.end());
+    if (adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        points[i].set(snapped[i * 2] * ShapeQuantum,
+                      snapped[i * 2 + 1] * ShapeQuantum);
+    }
+    return true;
+}
+
+sketch::TessMethod
+sketch::Tessellator::_TriangulatePath(
+    const CoplanarPath* coplanar,
+    Scratch* scratch,
+    TriList* dest) const
+{
+    TriList& tris = *dest;
+    float arcTessLength = 0;
+
+    const Vec2List& rim2d = scratch->Coords;
+    const IndexList& indices = scratch->Indices;
+    _scene->_WalkPath(coplanar, &scratch->Coords, arcTessLength, &scratch->Indices);
+
+    if (rim2d.size() == 3) {
+        tris.push_back(ivec3(indices[0],indices[1], indices[2]));
+        return TESS_QUAD;
+    }
+
+    if (rim2d.size() < 3) {
+        return TESS_NONE;
+    }
 
-        if (rim2d.size() == 4 && coplanar->Holes.empty()) {
-            _tris.push_back(ivec3(indices[0],indices[1], indices[2]));
-            _tris.push_back(ivec3(indices[2],indices[3], indices[0]));
+    if (rim2d.size() == 4 && coplanar->Holes.empty()) {
+        tris.push_back(ivec3(indices[0],indices[1], indices[2]));
+        tris.push_back(ivec3(indices[2],indices[3], indices[0]));
+        return TESS_QUAD;
+    }
+
+    // Gather the rim and all visible holes into the pool before handing
+    // out any pointers, since the pool may need to grow.
+    size_t count = 0;
+    _AppendPoints(rim2d, indices, &count, scratch);
+    size_t rimCount = count;
+
+    scratch->HoleEnds.clear();
+    FOR_EACH(hole, coplanar->Holes) {
+
+        const CoplanarPath* copHole = AsCoplanar(*hole);
+        pezCheck(copHole != NULL);
+
+        if (not copHole->Visible) {
             continue;
         }
 
-        list<vector<p2t::Point*> > holes;
-        vector<p2t::Point*> polyline;
-        map<p2t::Point*, unsigned int> pointmap;
-        FOR_EACH(p, rim2d) {
-            p2t::Point* newp = new p2t::Point(p->x, p->y);
-            pointmap[newp] = indices[p - rim2d.begin()];
-            polyline.push_back(newp);
-        }
-        if (polyline.size() > 3) {
-            p2t::CDT* cdt = new p2t::CDT(polyline);
-
-            FOR_EACH(hole, coplanar->Holes) {
-
-                CoplanarPath* copHole = dynamic_cast<CoplanarPath*>(*hole);
-                pezCheck(copHole != NULL);
-
-                if (not copHole->Visible) {
-                    continue;
-                }
-
-                Vec2List holePath;
-                IndexList indices;
-                _scene->_WalkPath(copHole, &holePath, arcTessLength, &indices);
-                vector<p2t::Point*> polyline;
-                FOR_EACH(p, holePath) {
-                    p2t::Point* newp = new p2t::Point(p->x, p->y);
-                    pointmap[newp] = indices[p - holePath.begin()];
-                    polyline.push_back(newp);
-                }
-                cdt->AddHole(polyline);
-                holes.push_back(polyline);
+        _scene->_WalkPath(copHole, &scratch->Coords, arcTessLength, &scratch->Indices);
+        _AppendPoints(scratch->Coords, scratch->Indices, &count, scratch);
+        scratch->HoleEnds.push_back(count);
+    }
+
+    if (scratch->HoleEnds.empty() && _TriangulateConvex(count, scratch, dest)) {
+        return TESS_FAN;
+    }
+
+    if (_TriangulateRectilinear(count, scratch, dest)) {
+        return TESS_RECTILINEAR;
+    }
+
+    TessPoints& points = scratch->Points;
+    bool caching;
+    {
+        tthread::lock_guard<tthread::mutex> guard(_shapeCacheMutex);
+        caching = _shapeCaching;
+    }
+    caching = caching && _SnapShape(count, rimCount, scratch);
+    if (caching) {
+        tthread::lock_guard<tthread::mutex> guard(_shapeCacheMutex);
+        ShapeCache::const_iterator shape = _shapeCache.find(scratch->ShapeKey);
+        if (shape != _shapeCache.end()) {
+            ++_shapeCacheHits;
+            FOR_EACH(t, shape->second) {
+                tris.push_back(ivec3(points[t->x].Index,
+                                     points[t->y].Index,
+                                     points[t->z].Index));
             }
+            return TESS_CACHED;
+        }
+        ++_shapeCacheMisses;
+    }
+
+    vector<p2t::Point*>& polyline = scratch->Polyline;
+    polyline.clear();
+    for (size_t i = 0; i < rimCount; ++i) {
+        polyline.push_back(&points[i]);
+    }
+
+    p2t::CDT& cdt = scratch->Cdt;
+    cdt.Reset(polyline);
+
+    size_t holeBegin = rimCount;
+    FOR_EACH(holeEnd, scratch->HoleEnds) {
+        polyline.clear();
+        for (size_t i = holeBegin; i < *holeEnd; ++i) {
+            polyline.push_back(&points[i]);
+        }
+        cdt.AddHole(polyline);
+        holeBegin = *holeEnd;
+    }
+
+    // We may also wish to add Steiner points here, but I see no
+    // reason to do so at the moment:
+    // http://www.cs.cmu.edu/~quake/triangle.defs.html
 
-            // We may also wish to add Steiner points here, but I see no
-            // reason to do so at the moment:
-            // http://www.cs.cmu.edu/~quake/triangle.defs.html
+    cdt.Triangulate();
+    const vector<p2t::Triangle*>& triangles = cdt.GetTriangles();
 
-            cdt->Triangulate();
-            vector<p2t::Triangle*> triangles = cdt->GetTriangles();
+    // Convert to pool indices so that the result can be shared.
+    const TessPoint* base = &points[0];
+    TriList& local = scratch->Template;
+    local.clear();
+    FOR_EACH(t, triangles) {
+        int a = static_cast<TessPoint*>((*t)->GetPoint(0)) - base;
+        int b = static_cast<TessPoint*>((*t)->GetPoint(1)) - base;
+        int c = static_cast<TessPoint*>((*t)->GetPoint(2)) - base;
+        local.push_back(ivec3(a, b, c));
+    }
 
-            FOR_EACH(t, triangles) {
-                unsigned au = pointmap[(*t)->GetPoint(0)];
-                unsigned bu = pointmap[(*t)->GetPoint(1)];
-                unsigned cu = pointmap[(*t)->GetPoint(2)];
-                _tris.push_back(ivec3(au, bu, cu));
+    if (caching) {
+        tthread::lock_guard<tthread::mutex> guard(_shapeCacheMutex);
+        if (_shapeCaching) {
+            if (_shapeCache.size() >= MaxShapeCacheEntries) {
+                _shapeCache.clear();
             }
+            _shapeCache.insert(ShapeCache::value_type(scratch->ShapeKey, local));
+        }
+    }
+
+    FOR_EACH(t, local) {
+        tris.push_back(ivec3(points[t->x].Index,
+                             points[t->y].Index,
+                             points[t->z].Index));
+    }
+    return TESS_DELAUNAY;
+}
+
+// Appends a triangle of pooled points, flipped if necessary so that it
+// winds counter-clockwise in the plane, same as the ones from poly2tri.
+void
+sketch::Tessellator::_AppendTriangle(
+    const TessPoints& points,
+    int a, int b, int c,
+    TriList* dest)
+{
+    double cross =
+        (points[b].x - points[a].x) * (points[c].y - points[a].y) -
+        (points[b].y - points[a].y) * (points[c].x - points[a].x);
+    if (cross < 0) {
+        std::swap(b, c);
+    }
+    dest->push_back(ivec3(points[a].Index, points[b].Index, points[c].Index));
+}
+
+// Fans out from the first point if the pooled rim is strictly convex.
+// Every corner must turn the same way, and the edges may only reverse
+// their horizontal and vertical directions twice each, which rules out
+// outlines that wind around more than once.
+bool
+sketch::Tessellator::_TriangulateConvex(
+    size_t count,
+    Scratch* scratch,
+    TriList* dest)
+{
+    const TessPoints& points = scratch->Points;
 
-            delete cdt;
+    double area = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const TessPoint& p = points[i];
+        const TessPoint& q = points[(i + 1) % count];
+        area += p.x * q.y - q.x * p.y;
+    }
+    if (area == 0) {
+        return false;
+    }
+    double winding = area > 0 ? 1 : -1;
+
+    int xFlips = 0, yFlips = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const TessPoint& a = points[(i + count - 1) % count];
+        const TessPoint& b = points[i];
+        const TessPoint& c = points[(i + 1) % count];
+        double dx0 = b.x - a.x, dy0 = b.y - a.y;
+        double dx1 = c.x - b.x, dy1 = c.y - b.y;
+        double cross = dx0 * dy1 - dy0 * dx1;
+        double lengths = sqrt((dx0 * dx0 + dy0 * dy0) * (dx1 * dx1 + dy1 * dy1));
+        if (winding * cross <= ConvexTolerance * lengths) {
+            return false;
         }
-        FOR_EACH(p, polyline) {
-            delete *p;
+        xFlips += dx0 * dx1 < 0;
+        yFlips += dy0 * dy1 < 0;
+    }
+    if (xFlips > 2 || yFlips > 2) {
+        return false;
+    }
+
+    for (size_t i = 2; i < count; ++i) {
+        _AppendTriangle(points, 0, i - 1, i, dest);
+    }
+    return true;
+}
+
+// Reads four consecutive points of the frame as an axis-aligned rectangle,
+// in whatever order they were drawn.
+bool
+sketch::Tessellator::_GetRect(const Vec2List& frame, int begin, Rect* rect)
+{
+    rect->Min = rect->Max = frame[begin];
+    for (int i = begin + 1; i < begin + 4; ++i) {
+        rect->Min = glm::min(rect->Min, frame[i]);
+        rect->Max = glm::max(rect->Max, frame[i]);
+    }
+    vec2 size = rect->Max - rect->Min;
+    float tolerance = RectTolerance * (size.x + size.y);
+    if (size.x <= tolerance || size.y <= tolerance) {
+        return false;
+    }
+
+    unsigned int seen = 0;
+    for (int i = begin; i < begin + 4; ++i) {
+        vec2 p = frame[i];
+        bool left = p.x - rect->Min.x < tolerance;
+        bool right = rect->Max.x - p.x < tolerance;
+        bool bottom = p.y - rect->Min.y < tolerance;
+        bool top = rect->Max.y - p.y < tolerance;
+        if (left == right || bottom == top) {
+            return false;
+        }
+        int corner = (right ? BR : BL) | (top ? TL : BL);
+        seen |= 1 << corner;
+        rect->Corners[corner] = i;
+    }
+    return seen == 0xf;
+}
+
+// Handles the walls of the buildings: a rectangle with a grid of equally
+// sized rows and columns of rectangular holes.  The gaps between holes are
+// split into quads, and the margins around the grid into four trapezoids
+// that are fanned out from a corner of the rim.
+bool
+sketch::Tessellator::_TriangulateRectilinear(
+    size_t count,
+    Scratch* scratch,
+    TriList* dest)
+{
+    const TessPoints& points = scratch->Points;
+    const vector<size_t>& holeEnds = scratch->HoleEnds;
+    size_t holeCount = holeEnds.size();
+    if (holeCount == 0 || count != 4 * (holeCount + 1)) {
+        return false;
+    }
+    for (size_t h = 0; h < holeCount; ++h) {
+        if (holeEnds[h] != 4 * (h + 2)) {
+            return false;
+        }
+    }
+
+    // Express everything in a frame whose x axis follows the first edge.
+    vec2 origin(points[0].x, points[0].y);
+    vec2 u = vec2(points[1].x, points[1].y) - origin;
+    if (u.x == 0 && u.y == 0) {
+        return false;
+    }
+    u = normalize(u);
+    vec2 v(-u.y, u.x);
+    Vec2List& frame = scratch->Frame;
+    frame.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        vec2 d = vec2(points[i].x, points[i].y) - origin;
+        frame[i] = vec2(dot(d, u), dot(d, v));
+    }
+
+    Rect rim;
+    if (not _GetRect(frame, 0, &rim)) {
+        return false;
+    }
+    vec2 size = rim.Max - rim.Min;
+    float tolerance = RectTolerance * (size.x + size.y);
+
+    Rects& holes = scratch->Holes;
+    holes.resize(holeCount);
+    for (size_t h = 0; h < holeCount; ++h) {
+        Rect& hole = holes[h];
+        if (not _GetRect(frame, 4 * (h + 1), &hole)) {
+            return false;
+        }
+        if (hole.Min.x - rim.Min.x <= tolerance ||
+            hole.Min.y - rim.Min.y <= tolerance ||
+            rim.Max.x - hole.Max.x <= tolerance ||
+            rim.Max.y - hole.Max.y <= tolerance) {
+            return false;
         }
-        FOR_EACH(h, holes) {
-            FOR_EACH(p, *h) {
-                delete *p;
+    }
+
+    // Sort the holes into rows, and each row into columns.
+    std::sort(holes.begin(), holes.end(), _IsRectBelow);
+    size_t columns = 1;
+    while (columns < holeCount &&
+           holes[columns].Min.y - holes[0].Min.y < tolerance) {
+        ++columns;
+    }
+    if (holeCount % columns) {
+        return false;
+    }
+    size_t rows = holeCount / columns;
+    for (size_t r = 0; r < rows; ++r) {
+        std::sort(holes.begin() + r * columns,
+                  holes.begin() + (r + 1) * columns,
+                  _IsRectLeftOf);
+    }
+
+    // Every hole must line up with the first one of its row and column,
+    // and neighbors may neither touch nor overlap.
+    for (size_t r = 0; r < rows; ++r) {
+        for (size_t c = 0; c < columns; ++c) {
+            const Rect& hole = holes[r * columns + c];
+            const Rect& rowHead = holes[r * columns];
+            const Rect& columnHead = holes[c];
+            if (abs(hole.Min.y - rowHead.Min.y) > tolerance ||
+                abs(hole.Max.y - rowHead.Max.y) > tolerance ||
+                abs(hole.Min.x - columnHead.Min.x) > tolerance ||
+                abs(hole.Max.x - columnHead.Max.x) > tolerance) {
+                return false;
+            }
+            if (c > 0 && hole.Min.x - holes[r * columns + c - 1].Max.x <= tolerance) {
+                return false;
+            }
+            if (r > 0 && hole.Min.y - holes[(r - 1) * columns + c].Max.y <= tolerance) {
+                return false;
             }
         }
     }
-    _topologyHashDelaunay = _scene->GetTopologyHash();
+
+    #define CORNER(r, c, corner) holes[(r) * columns + (c)].Corners[corner]
+    #define QUAD(a, b, c, d) \
+        _AppendTriangle(points, a, b, c, dest); \
+        _AppendTriangle(points, a, c, d, dest)
+
+    // Gaps between columns, gaps between rows, and where they cross.
+    for (size_t r = 0; r < rows; ++r) {
+        for (size_t c = 0; c + 1 < columns; ++c) {
+            QUAD(CORNER(r, c, BR), CORNER(r, c + 1, BL),
+                 CORNER(r, c + 1, TL), CORNER(r, c, TR));
+        }
+    }
+    for (size_t r = 0; r + 1 < rows; ++r) {
+        for (size_t c = 0; c < columns; ++c) {
+            QUAD(CORNER(r, c, TL), CORNER(r, c, TR),
+                 CORNER(r + 1, c, BR), CORNER(r + 1, c, BL));
+        }
+    }
+    for (size_t r = 0; r + 1 < rows; ++r) {
+        for (size_t c = 0; c + 1 < columns; ++c) {
+            QUAD(CORNER(r, c, TR), CORNER(r, c + 1, TL),
+                 CORNER(r + 1, c + 1, BL), CORNER(r + 1, c, BR));
+        }
+    }
+
+    // Margins, walking the outside of the grid counter-clockwise starting
+    // from its bottom-right corner.
+    int apex = rim.Corners[BL];
+    int previous = rim.Corners[BR];
+    for (size_t c = columns; c-- > 0;) {
+        _AppendTriangle(points, apex, previous, CORNER(0, c, BR), dest);
+        _AppendTriangle(points, apex, CORNER(0, c, BR), CORNER(0, c, BL), dest);
+        previous = CORNER(0, c, BL);
+    }
+    apex = rim.Corners[TL];
+    previous = rim.Corners[BL];
+    for (size_t r = 0; r < rows; ++r) {
+        _AppendTriangle(points, apex, previous, CORNER(r, 0, BL), dest);
+        _AppendTriangle(points, apex, CORNER(r, 0, BL), CORNER(r, 0, TL), dest);
+        previous = CORNER(r, 0, TL);
+    }
+    apex = rim.Corners[TR];
+    previous = rim.Corners[TL];
+    for (size_t c = 0; c < columns; ++c) {
+        _AppendTriangle(points, apex, previous, CORNER(rows - 1, c, TL), dest);
+        _AppendTriangle(points, apex, CORNER(rows - 1, c, TL), CORNER(rows - 1, c, TR), dest);
+        previous = CORNER(rows - 1, c, TR);
+    }
+    apex = rim.Corners[BR];
+    previous = rim.Corners[TR];
+    for (size_t r = rows; r-- > 0;) {
+        _AppendTriangle(points, apex, previous, CORNER(r, columns - 1, TR), dest);
+        _AppendTriangle(points, apex, CORNER(r, columns - 1, TR), CORNER(r, columns - 1, BR), dest);
+        previous = CORNER(r, columns - 1, BR);
+    }
+
+    #undef QUAD
+    #undef CORNER
+    return true;
+}
+
+void
+sketch::Tessellator::CountMethods(size_t counts[NUM_TESS_METHODS]) const
+{
+    for (int m = 0; m < NUM_TESS_METHODS; ++m) {
+        counts[m] = 0;
+    }
+    FOR_EACH(range, _ranges) {
+        ++counts[range->Method];
+    }
+}
+
+void
+sketch::Tessellator::SetShapeCaching(bool enabled)
+{
+    tthread::lock_guard<tthread::mutex> guard(_shapeCacheMutex);
+    _shapeCaching = enabled;
+    if (not enabled) {
+        _shapeCache.clear();
+    }
 }
 
+void
+sketch::Tessellator::ClearShapeCache()
+{
+    tthread::lock_guard<tthread::mutex> guard(_shapeCacheMutex);
+    _shapeCache.clear();
+    _shapeCacheHits = 0;
+    _shapeCacheMisses = 0;
+}
+
+size_t
+sketch::Tessellator::GetShapeCacheHits()
+{
+    tthread::lock_guard<tthread::mutex> guard(_shapeCacheMutex);
+    return _shapeCacheHits;
+}
+
+size_t
+sketch::Tessellator::GetShapeCacheMisses()
+{
+    tthread::lock_guard<tthread::mutex> guard(_shapeCacheMutex);
+    return _shapeCacheMisses;
+}
+
+size_t
+sketch::Tessellator::GetShapeCacheSize()
+{
+    tthread::lock_guard<tthread::mutex> guard(_shapeCacheMutex);
+    return _shapeCache.size();
+}
+
+VertexAttribMask
+sketch::Tessellator::GetVertexAttribs() const
+{
+    return _facets ? FacetAttribs : VertexAttribMask(AttrPositionFlag);
+}
+
+// Only the blocks of vertices that changed since the previous call are
+// sent to the GPU.  The vertex buffer is allocated with some headroom,
+// since extrusions keep adding points during playback.
 void
 sketch::Tessellator::PushToGpu(Vao& vao)
 {
-    Vec3List& verts = *(const_cast<Vec3List*>(&_scene->_points));
- 
     if (!vao.vao) {
-        vao = Vao(verts, _tris);
+        vao.Init();
+        glBindVertexArray(vao.vao);
+        glGenBuffers(1, &vao.vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vao.vbo);
+        Vao::SetInterleavedPointers(GetVertexAttribs());
+        glGenBuffers(1, &vao.ibo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vao.ibo);
+        pezCheck(glGetError() == GL_NO_ERROR, "Tessellator VAO setup failed");
+        vao.vertexCount = 0;
         vao.indexCount = 0;
+        vao.indexType = GL_UNSIGNED_INT;
+        _gpuVertexCapacity = 0;
     }
 
     vao.Bind();
@@ -135,21 +772,196 @@ sketch::Tessellator::PushToGpu(Vao& vao)
 
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
-    glBufferData(GL_ARRAY_BUFFER, 
-                 sizeof(verts[0]) * verts.size(), 
-                 &verts[0], 
-                 GL_STATIC_DRAW);
-    Vao::totalBytesBuffered += sizeof(verts[0]) * verts.size();
+    bool indicesChanged = _UpdateStream();
+    const char* verts = (const char*) _GetVertices();
+    size_t vertexCount = _GetVertexCount();
+    size_t vertexSize = Vao::GetStride(GetVertexAttribs());
+    if (vertexCount > _gpuVertexCapacity) {
+        _gpuVertexCapacity = vertexCount + vertexCount / 2;
+        glBufferData(GL_ARRAY_BUFFER,
+                     vertexSize * _gpuVertexCapacity,
+                     NULL,
+                     GL_DYNAMIC_DRAW);
+        Vao::totalBytesBuffered += vertexSize * _gpuVertexCapacity;
+        _changedVertices.assign(1, uvec2(0, vertexCount));
+    }
+    FOR_EACH(range, _changedVertices) {
+        size_t count = range->y - range->x;
+        glBufferSubData(GL_ARRAY_BUFFER,
+                        vertexSize * range->x,
+                        vertexSize * count,
+                        verts + vertexSize * range->x);
+        Vao::frameBytesUploaded += vertexSize * count;
+    }
+    vao.vertexCount = vertexCount;
 
-    if (_topologyHashPushToGpu != _scene->GetTopologyHash()) {
-    
+    GLenum indexType = vertexCount < MaxShortIndexVertices ?
+        GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    if (indicesChanged || indexType != vao.indexType) {
+        size_t indexCount = _GetIndexCount();
+        const void* indices = _GetIndices();
+        size_t indexSize = sizeof(unsigned int);
+        if (indexType == GL_UNSIGNED_SHORT) {
+            _shortIndices.assign(_GetIndices(), _GetIndices() + indexCount);
+            indices = _shortIndices.empty() ? NULL : &_shortIndices[0];
+            indexSize = sizeof(unsigned short);
+        }
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, 
-                     sizeof(_tris[0]) * _tris.size(), 
-                     &_tris[0], 
+                     indexSize * indexCount, 
+                     indices, 
                      GL_STATIC_DRAW);
-        Vao::totalBytesBuffered += sizeof(_tris[0]) * _tris.size();
+        Vao::totalBytesBuffered += indexSize * indexCount;
+        Vao::frameBytesUploaded += indexSize * indexCount;
+
+        vao.indexCount = indexCount;
+        vao.indexType = indexType;
+    }
+}
+
+void
+sketch::Tessellator::PushToGpu(GeometryPool& pool, GeometryPool::Handle mesh)
+{
+    pezCheck(pool.GetAttribs() == GetVertexAttribs(),
+             "Geometry pool doesn't match the tessellator's vertex format.");
+
+    bool indicesChanged = _UpdateStream();
+    const char* verts = (const char*) _GetVertices();
+    size_t vertexCount = _GetVertexCount();
+    size_t vertexSize = Vao::GetStride(GetVertexAttribs());
+    size_t indexCount = _GetIndexCount();
+
+    if (vertexCount > pool.GetVertexCapacity(mesh) ||
+        indexCount > pool.GetIndexCapacity(mesh)) {
+        pool.Resize(mesh, vertexCount + vertexCount / 2, indexCount + indexCount / 2);
+        _changedVertices.assign(1, uvec2(0, vertexCount));
+        indicesChanged = true;
+    }
+    FOR_EACH(range, _changedVertices) {
+        pool.SetVertices(mesh, range->x, range->y - range->x, verts + vertexSize * range->x);
+    }
 
-        vao.indexCount = _tris.size() * 3;
-        _topologyHashPushToGpu = _scene->GetTopologyHash();
+    if (indicesChanged) {
+        pool.SetIndices(mesh, indexCount, _GetIndices());
     }
 }
+
+// Facet vertices are cheap to regenerate, so they're rebuilt from scratch
+// whenever anything moved, then compared with what's already on the GPU.
+// Their indices never change unless the number of triangles does.
+bool
+sketch::Tessellator::_UpdateStream()
+{
+    _pointStampPushToGpu = _scene->GetChangedPoints(_pointStampPushToGpu, &_changedVertices);
+    bool topologyChanged = _topologyHashPushToGpu != _scene->GetTopologyHash();
+    _topologyHashPushToGpu = _scene->GetTopologyHash();
+    if (!_facets) {
+        if (topologyChanged && _cacheOptimization) {
+            size_t vertexCount = _scene->_points.size();
+            VertexCacheUtil::Optimize(_tris, vertexCount, &_optimizedTris);
+            _acmrBefore = VertexCacheUtil::GetAcmr(_tris, vertexCount);
+            _acmrAfter = VertexCacheUtil::GetAcmr(_optimizedTris, vertexCount);
+        }
+        return topologyChanged;
+    }
+    if (_changedVertices.empty() && !topologyChanged) {
+        return false;
+    }
+
+    _BuildFacets(&_nextFacetVertices);
+    const FacetVertices& prev = _facetVertices;
+    const FacetVertices& next = _nextFacetVertices;
+    _changedVertices.clear();
+    for (size_t begin = 0; begin < next.size(); begin += FacetBlockSize) {
+        size_t end = std::min(next.size(), begin + FacetBlockSize);
+        if (end <= prev.size() &&
+            !memcmp(&prev[begin], &next[begin], sizeof(next[0]) * (end - begin))) {
+            continue;
+        }
+        if (!_changedVertices.empty() && _changedVertices.back().y == begin) {
+            _changedVertices.back().y = end;
+        } else {
+            _changedVertices.push_back(uvec2(begin, end));
+        }
+    }
+    _facetVertices.swap(_nextFacetVertices);
+
+    size_t previousCount = _facetIndices.size();
+    if (previousCount == _facetVertices.size()) {
+        return false;
+    }
+    _facetIndices.resize(_facetVertices.size());
+    for (size_t i = previousCount; i < _facetIndices.size(); ++i) {
+        _facetIndices[i] = i;
+    }
+    return true;
+}
+
+// Mirrors what the Sketch.Facets geometry shader does with each triangle,
+// using its index within the tessellator as the primitive id.
+void
+sketch::Tessellator::_BuildFacets(FacetVertices* dest) const
+{
+    const Vec3List& points = _scene->_points;
+    dest->resize(_tris.size() * 3);
+    FacetVertex* v = dest->empty() ? NULL : &(*dest)[0];
+    for (size_t i = 0; i < _tris.size(); ++i, v += 3) {
+        const ivec3& tri = _tris[i];
+        v[0].Position = points[tri.x];
+        v[1].Position = points[tri.y];
+        v[2].Position = points[tri.z];
+
+        vec3 n = cross(v[2].Position - v[0].Position, v[1].Position - v[0].Position);
+        float len = length(n);
+        n = len > 0 ? n / len : vec3(0, 1, 0);
+
+        vec3 facet;
+        facet.x = distance(v[2].Position, v[1].Position) < ShortFacet ? 3 : 9;
+        facet.y = distance(v[1].Position, v[0].Position) > WideFacet ? 17 : 9;
+        facet.z = i <= 1 ? 1 : 0;
+
+        if (i % 2 == 0) {
+            v[0].TexCoord = vec2(0, 0);
+            v[1].TexCoord = vec2(0, 1);
+            v[2].TexCoord = vec2(1, 1);
+        } else {
+            v[0].TexCoord = vec2(1, 1);
+            v[1].TexCoord = vec2(1, 0);
+            v[2].TexCoord = vec2(0, 0);
+        }
+        for (int c = 0; c < 3; ++c) {
+            v[c].Normal = n;
+            v[c].Facet = facet;
+        }
+    }
+}
+
+const void*
+sketch::Tessellator::_GetVertices() const
+{
+    if (_facets) {
+        return _facetVertices.empty() ? NULL : &_facetVertices[0];
+    }
+    return _scene->_points.empty() ? NULL : &_scene->_points[0];
+}
+
+size_t
+sketch::Tessellator::_GetVertexCount() const
+{
+    return _facets ? _facetVertices.size() : _scene->_points.size();
+}
+
+const unsigned int*
+sketch::Tessellator::_GetIndices() const
+{
+    if (_facets) {
+        return _facetIndices.empty() ? NULL : &_facetIndices[0];
+    }
+    const TriList& tris = _cacheOptimization ? _optimizedTris : _tris;
+    return tris.empty() ? NULL : (const unsigned int*) &tris[0];
+}
+
+size_t
+sketch::Tessellator::_GetIndexCount() const
+{
+    return _facets ? _facetIndices.size() : _tris.size() * 3;
+}
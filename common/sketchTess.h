@@ -1,21 +1,222 @@
 #pragma once
+#include "poly2tri/poly2tri.h"
 #include "common/sketchScene.h"
+#include "common/geometryPool.h"
 #include "common/typedefs.h"
 
 class Vao;
 
 namespace sketch
 {
+    class BakedPlayback;
+
+    // How the Tessellator produced the triangles of a path.
+    enum TessMethod {
+        TESS_NONE,          // hidden, or fewer than three points
+        TESS_QUAD,          // lone triangle or hole-free quad
+        TESS_FAN,           // hole-free convex polygon
+        TESS_RECTILINEAR,   // rectangle with a grid of rectangular holes
+        TESS_CACHED,        // shape cache hit
+        TESS_DELAUNAY,      // poly2tri
+        NUM_TESS_METHODS,
+    };
+
+    // Unshared vertex of a triangle, carrying everything that the facet
+    // shading used to derive per-triangle in a geometry shader.  Facet is
+    // the number of window rows and columns, and whether it's a roof.
+    struct FacetVertex
+    {
+        glm::vec3 Position;
+        glm::vec3 Normal;
+        glm::vec2 TexCoord;
+        glm::vec3 Facet;
+    };
+    typedef std::vector<FacetVertex> FacetVertices;
+
     class Tessellator
     {
     public:
         Tessellator(const sketch::Scene& scene);
         void PullFromScene();
         void PushToGpu(Vao& vao);
+
+        // Ditto, but into a mesh of a shared pool, which is resized as
+        // needed.  A tessellator should only ever push to one destination.
+        void PushToGpu(GeometryPool& pool, GeometryPool::Handle mesh);
+
+        // When enabled, every triangle gets its own three FacetVertex
+        // instead of sharing the scene's points, so that programs can do
+        // flat shading without a geometry shader.  Call before the first
+        // PushToGpu; pools must be created with GetVertexAttribs.
+        void EnableFacets(bool enabled) { _facets = enabled; }
+        VertexAttribMask GetVertexAttribs() const;
+        static const VertexAttribMask FacetAttribs;
+
+        // Whether facets are enabled on construction, and hence whether
+        // the effects draw sketches with Sketch.Flat or with the geometry
+        // shader of Sketch.Facets.
+        static const bool DefaultFacets = true;
+
+        // When enabled, the triangles are reordered for the post-transform
+        // vertex cache whenever the topology changes, which pays off for
+        // meshes that are drawn far more often than they're edited.  Has
+        // no effect with facets, whose vertices are never shared.  Call
+        // before the first PushToGpu.  The ACMR of the most recent
+        // reordering is reported before and after.
+        void EnableCacheOptimization(bool enabled) { _cacheOptimization = enabled; }
+        float GetAcmrBefore() const { return _acmrBefore; }
+        float GetAcmrAfter() const { return _acmrAfter; }
+
+        // Which method produced the current triangles of a path, given its
+        // position in the scene's path list, and how many paths each
+        // method is currently responsible for.
+        TessMethod GetMethod(size_t path) const { return _ranges[path].Method; }
+        void CountMethods(size_t counts[NUM_TESS_METHODS]) const;
+
+        // When enabled, PullFromScene hands large batches of dirty paths to
+        // the shared WorkerPool.  The output is identical either way.
+        void EnableParallel(bool enabled) { _parallel = enabled; }
+
+        // Triangulations are cached process-wide, keyed by the plane-space
+        // outline of a path and its holes, so that the identical walls and
+        // roofs that get stamped out across scenes only go through poly2tri
+        // once.  The cache is bounded: it's emptied whenever it fills up,
+        // which only costs the shapes in use a second trip through
+        // poly2tri.  Disabling the cache also empties it.
+        static void SetShapeCaching(bool enabled);
+        static void ClearShapeCache();
+        static size_t GetShapeCacheHits();
+        static size_t GetShapeCacheMisses();
+        static size_t GetShapeCacheSize();
     private:
+
+        // State of a path or hole at the time it was triangulated.
+        // Restoring a snapshot can put a different path at the same
+        // position in the scene, with the same generation, so the path's
+        // own index is checked too.
+        struct PathState
+        {
+            unsigned int Index;
+            unsigned int Generation;
+            bool Visible;
+            bool operator==(const PathState& other) const;
+        };
+        typedef std::vector<PathState> PathStates;
+
+        // Triangles that were generated for a given path, along with the
+        // state of the path and of each of its holes at the time.  The hole
+        // states live in _holeStates.
+        struct PathRange
+        {
+            PathState State;
+            size_t FirstHole;
+            size_t HoleCount;
+            TessMethod Method;
+            size_t Offset;
+            size_t Count;
+        };
+        typedef std::vector<PathRange> PathRanges;
+
+        // Path that needs to be re-triangulated, along with where its
+        // triangles ended up.
+        struct DirtyPath
+        {
+            size_t Path;
+            unsigned int Participant;
+            TessMethod Method;
+            size_t Offset;
+            size_t Count;
+        };
+        typedef std::vector<DirtyPath> DirtyPaths;
+
+        static PathState _GetState(const Path* path);
+
+        // poly2tri point that remembers which scene point it came from.
+        struct TessPoint : p2t::Point
+        {
+            unsigned int Index;
+        };
+        typedef std::vector<TessPoint> TessPoints;
+
+        // Axis-aligned rectangle in the frame of a rectilinear path.  The
+        // corners are indices into the point pool.
+        enum { BL, BR, TL, TR };
+        struct Rect
+        {
+            glm::vec2 Min;
+            glm::vec2 Max;
+            int Corners[4];
+        };
+        typedef std::vector<Rect> Rects;
+
+        // Scratch state that is recycled from one path to the next, so
+        // that re-triangulation doesn't need to touch the heap once the
+        // buffers have grown large enough.
+        struct Scratch
+        {
+            p2t::CDT Cdt;
+            TessPoints Points;
+            std::vector<p2t::Point*> Polyline;
+            std::vector<size_t> HoleEnds;
+            Vec2List Coords;
+            IndexList Indices;
+            std::vector<int> ShapeKey;
+            std::vector<std::pair<int, int> > SnappedPoints;
+            TriList Template;
+            Vec2List Frame;
+            Rects Holes;
+        };
+
+        TessMethod _TriangulatePath(const CoplanarPath* path, Scratch* scratch, TriList* dest) const;
+        static void _AppendPoints(const Vec2List& coords, const IndexList& indices, size_t* count, Scratch* scratch);
+        static void _AppendTriangle(const TessPoints& points, int a, int b, int c, TriList* dest);
+        static bool _TriangulateConvex(size_t count, Scratch* scratch, TriList* dest);
+        static bool _TriangulateRectilinear(size_t count, Scratch* scratch, TriList* dest);
+        static bool _GetRect(const Vec2List& frame, int begin, Rect* rect);
+        static bool _IsRectBelow(const Rect& a, const Rect& b) { return a.Min.y < b.Min.y; }
+        static bool _IsRectLeftOf(const Rect& a, const Rect& b) { return a.Min.x < b.Min.x; }
+        static bool _SnapShape(size_t count, size_t rimCount, Scratch* scratch);
+
+        // Catches up with the scene since the previous push, leaving the
+        // ranges of vertices to upload in _changedVertices.  Returns true
+        // if the indices need to be uploaded as well.
+        bool _UpdateStream();
+        void _BuildFacets(FacetVertices* dest) const;
+        const void* _GetVertices() const;
+        size_t _GetVertexCount() const;
+        const unsigned int* _GetIndices() const;
+        size_t _GetIndexCount() const;
+
+        // Triangulates every stride'th dirty path, starting at the given one.
+        void _TriangulateDirty(unsigned int participant, unsigned int stride, Scratch* scratch);
+        static void _TriangulateJob(void* arg, unsigned int participant);
+        static Scratch* _GetPoolScratch(unsigned int participant);
+
         const sketch::Scene* _scene;
         TriList _tris;
+        TriList _nextTris;
+        PathRanges _ranges;
+        PathStates _holeStates;
+        PathStates _nextHoleStates;
+        Scratch _scratch;
+        DirtyPaths _dirty;
+        std::vector<TriList> _participantTris;
+        bool _parallel;
+        bool _facets;
+        bool _cacheOptimization;
+        TriList _optimizedTris;
+        float _acmrBefore;
+        float _acmrAfter;
+        std::vector<unsigned short> _shortIndices;
+        FacetVertices _facetVertices;
+        FacetVertices _nextFacetVertices;
+        IndexList _facetIndices;
         unsigned int _topologyHashPushToGpu;
+        unsigned int _pointStampPushToGpu;
+        size_t _gpuVertexCapacity;
+        std::vector<glm::uvec2> _changedVertices;
         unsigned int _topologyHashDelaunay;
+
+        friend class BakedPlayback;
     };
 }
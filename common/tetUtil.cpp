@@ -9,6 +9,17 @@
 using namespace glm;
 using namespace std;
 
+string
+TetUtil::TetgenSwitches(float qualityBound,
+                        float maxVolume,
+                        bool quiet)
+{
+    const char* formatString = quiet ? "nAQpq%.3fa%.7f" : "nApq%.3fa%.7f";
+    char configString[128];
+    sprintf(configString, formatString, qualityBound, maxVolume);
+    return configString;
+}
+
 // Thin wrapper for tetgen's "tetrahedralize" function.
 void
 TetUtil::TetsFromHull(const tetgenio& hull,
@@ -17,10 +28,8 @@ TetUtil::TetsFromHull(const tetgenio& hull,
                       float maxVolume,
                       bool quiet)
 {
-    const char* formatString = quiet ? "nAQpq%.3fa%.7f" : "nApq%.3fa%.7f";
-    char configString[128];
-    sprintf(configString, formatString, qualityBound, maxVolume);
-    tetrahedralize(configString, (tetgenio*) &hull, dest);
+    string configString = TetgenSwitches(qualityBound, maxVolume, quiet);
+    tetrahedralize(configString.c_str(), (tetgenio*) &hull, dest);
 }
 
 void
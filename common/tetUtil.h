@@ -1,9 +1,15 @@
 #include "common/typedefs.h"
 #include "tetgen/tetgen.h"
 #include "glm/glm.hpp"
+#include <string>
 
 namespace TetUtil
 {
+    // Command line that TetsFromHull passes to tetgen.
+    std::string TetgenSwitches(float qualityBound,
+                               float maxVolume,
+                               bool quiet);
+
     // Thin wrapper for tetgen's "tetrahedralize" function.
     void TetsFromHull(const tetgenio& hull,
                       tetgenio* dest,
@@ -2,10 +2,20 @@
 #include "init.h"
 
 int Vao::totalBytesBuffered = 0;
+int Vao::frameBytesUploaded = 0;
+int Vao::lastFrameBytesUploaded = 0;
+
+void
+Vao::NextFrame()
+{
+    lastFrameBytesUploaded = frameBytesUploaded;
+    frameBytesUploaded = 0;
+}
 
 Vao::Vao() :
     vertexCount(0),
     indexCount(0),
+    indexType(GL_UNSIGNED_INT),
     vao(0) 
 {
     /* nothing */
@@ -13,7 +23,8 @@ Vao::Vao() :
 
 Vao::Vao(int componentCount, const FloatList& verts) :
     vertexCount(verts.size() / componentCount),
-    indexCount(0) 
+    indexCount(0),
+    indexType(GL_UNSIGNED_INT)
 {    
     vao = ::InitVao(componentCount, verts);
     totalBytesBuffered += sizeof(verts[0]) * verts.size();
@@ -23,7 +34,8 @@ Vao::Vao(int componentCount,
             const FloatList& verts, 
             const IndexList& indices) :
     vertexCount(verts.size() / componentCount),
-    indexCount(indices.size()) 
+    indexCount(indices.size()),
+    indexType(GL_UNSIGNED_INT)
 {
     vao = ::InitVao(componentCount, verts, indices);
     totalBytesBuffered += sizeof(verts[0]) * verts.size();
@@ -34,7 +46,8 @@ Vao::Vao(int componentCount,
             const float* verts,
             unsigned vertCount) : 
     vertexCount(vertCount),
-    indexCount(0) 
+    indexCount(0),
+    indexType(GL_UNSIGNED_INT)
 {
     // TODO: we shouldn't be copying the buffer like this, we should just pass it raw
     vao = ::InitVao(componentCount, FloatList(verts, verts+vertCount*componentCount));
@@ -47,7 +60,8 @@ Vao::Vao(int componentCount,
             const unsigned* indices,
             unsigned indexCount) :
     vertexCount(vertCount),
-    indexCount(0) 
+    indexCount(0),
+    indexType(GL_UNSIGNED_INT)
 {
     // TODO: we shouldn't be copying the buffer like this, we should just pass it raw
     vao = ::InitVao(componentCount, 
@@ -59,7 +73,8 @@ Vao::Vao(int componentCount,
 
 Vao::Vao(const Vec3List& verts, const TriList& indices) : 
     vertexCount(verts.size()),
-    indexCount(indices.size())
+    indexCount(indices.size()),
+    indexType(GL_UNSIGNED_INT)
 {
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
@@ -85,7 +100,8 @@ Vao::Vao(const Vec3List& verts, const TriList& indices) :
 
 Vao::Vao(const Vec3List& verts) :
     vertexCount(verts.size()),
-    indexCount(0)
+    indexCount(0),
+    indexType(GL_UNSIGNED_INT)
 {
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
@@ -243,14 +259,28 @@ Vao::AddInterleaved(VertexAttribMask attribs,
     glBufferData(GL_ARRAY_BUFFER, data.size(), &data[0], GL_STATIC_DRAW);
     totalBytesBuffered += data.size(); 
 
+    this->vertexCount = data.size() / GetStride(attribs);
+    SetInterleavedPointers(attribs);
+}
+
+int
+Vao::GetStride(VertexAttribMask attribs)
+{
     int stride = 0;
-    if (attribs & AttrPositionFlag) stride += AttrPositionWidth;
-    if (attribs & AttrNormalFlag)   stride += AttrNormalWidth;
-    if (attribs & AttrTexCoordFlag) stride += AttrTexCoordWidth;
-    if (attribs & AttrTetIdFlag)    stride += AttrTetIdWidth;
-    if (attribs & AttrLengthFlag)   stride += AttrLengthWidth;
-    this->vertexCount = data.size() / stride;
+    if (attribs & AttrPositionFlag)   stride += AttrPositionWidth;
+    if (attribs & AttrNormalFlag)     stride += AttrNormalWidth;
+    if (attribs & AttrTexCoordFlag)   stride += AttrTexCoordWidth;
+    if (attribs & AttrTetIdFlag)      stride += AttrTetIdWidth;
+    if (attribs & AttrLengthFlag)     stride += AttrLengthWidth;
+    if (attribs & AttrBuildingIdFlag) stride += AttrBuildingIdWidth;
+    if (attribs & AttrFacetFlag)      stride += AttrFacetWidth;
+    return stride;
+}
 
+void
+Vao::SetInterleavedPointers(VertexAttribMask attribs)
+{
+    int stride = GetStride(attribs);
     int p = 0;
     if (attribs & AttrPositionFlag) {
         glVertexAttribPointer(AttrPosition, 3, GL_FLOAT, GL_FALSE, stride, offset(p));
@@ -277,4 +307,14 @@ Vao::AddInterleaved(VertexAttribMask attribs,
         glEnableVertexAttribArray(AttrLength);
         p += AttrLengthWidth;
     }
+    if (attribs & AttrBuildingIdFlag) {
+        glVertexAttribPointer(AttrBuildingId, 1, GL_FLOAT, GL_FALSE, stride, offset(p));
+        glEnableVertexAttribArray(AttrBuildingId);
+        p += AttrBuildingIdWidth;
+    }
+    if (attribs & AttrFacetFlag) {
+        glVertexAttribPointer(AttrFacet, 3, GL_FLOAT, GL_FALSE, stride, offset(p));
+        glEnableVertexAttribArray(AttrFacet);
+        p += AttrFacetWidth;
+    }
 }
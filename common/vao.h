@@ -12,8 +12,15 @@ public:
     
     static int totalBytesBuffered;
 
+    // Bytes sent by per-frame buffer updates during the current and the
+    // previous frame, as opposed to the one-time uploads above.
+    static int frameBytesUploaded;
+    static int lastFrameBytesUploaded;
+    static void NextFrame();
+
     unsigned vertexCount;
     unsigned indexCount;
+    GLenum indexType;
     GLuint vao;
     GLuint vbo;
     GLuint ibo;
@@ -60,6 +67,11 @@ public:
     void AddInterleaved(VertexAttribMask attribs,
                         const Blob& data);
 
+    // Size of one interleaved vertex with the given attributes, and the
+    // attribute setup for reading them from the bound GL_ARRAY_BUFFER.
+    static int GetStride(VertexAttribMask attribs);
+    static void SetInterleavedPointers(VertexAttribMask attribs);
+
     void AddIndices(const Blob& data);
 
     void Bind();
@@ -0,0 +1,191 @@
+#include "common/vertexCacheUtil.h"
+#include <cmath>
+
+using namespace glm;
+using namespace std;
+
+// Size of the LRU cache that Optimize assumes, and the scoring parameters
+// from the paper.
+static const int ModelCacheSize = 32;
+static const float CacheDecayPower = 1.5f;
+static const float LastTriScore = 0.75f;
+static const float ValenceBoostScale = 2.0f;
+static const float ValenceBoostPower = 0.5f;
+
+// Size of the FIFO cache that GetAcmr simulates.
+static const size_t SimulatedCacheSize = 16;
+
+struct VertexState
+{
+    int CachePos;
+    float Score;
+    size_t FirstTri;
+    size_t Remaining;
+};
+
+static float
+_ScoreVertex(int cachePos, size_t remaining)
+{
+    if (remaining == 0) {
+        return -1.0f;
+    }
+
+    float score = 0;
+    if (cachePos >= 0) {
+        if (cachePos < 3) {
+            // The vertices of the previous triangle get a fixed score, so
+            // that strips and fans aren't unduly favoured.
+            score = LastTriScore;
+        } else {
+            float scaler = 1.0f / (ModelCacheSize - 3);
+            score = pow(1.0f - (cachePos - 3) * scaler, CacheDecayPower);
+        }
+    }
+
+    // Vertices with few triangles left get a boost, so that lone
+    // triangles don't get stranded.
+    score += ValenceBoostScale * pow(float(remaining), -ValenceBoostPower);
+    return score;
+}
+
+// Greedily emits the best-scoring triangle among those that touch the
+// cache, falling back to the first leftover triangle when there are none.
+void
+VertexCacheUtil::Optimize(const TriList& tris,
+                          size_t vertexCount,
+                          TriList* dest)
+{
+    const size_t triCount = tris.size();
+    dest->clear();
+    dest->reserve(triCount);
+    if (triCount == 0) {
+        return;
+    }
+
+    // Gather the triangles of each vertex into one flat array.
+    vector<VertexState> verts(vertexCount);
+    FOR_EACH(tri, tris) {
+        for (int c = 0; c < 3; ++c) {
+            verts[(*tri)[c]].Remaining++;
+        }
+    }
+    size_t offset = 0;
+    FOR_EACH(v, verts) {
+        v->CachePos = -1;
+        v->FirstTri = offset;
+        offset += v->Remaining;
+        v->Remaining = 0;
+    }
+    vector<size_t> adjacency(offset);
+    for (size_t t = 0; t < triCount; ++t) {
+        for (int c = 0; c < 3; ++c) {
+            VertexState& v = verts[tris[t][c]];
+            adjacency[v.FirstTri + v.Remaining++] = t;
+        }
+    }
+
+    FOR_EACH(v, verts) {
+        v->Score = _ScoreVertex(-1, v->Remaining);
+    }
+    vector<float> triScores(triCount);
+    size_t best = 0;
+    for (size_t t = 0; t < triCount; ++t) {
+        const ivec3& tri = tris[t];
+        triScores[t] = verts[tri.x].Score + verts[tri.y].Score + verts[tri.z].Score;
+        if (triScores[t] > triScores[best]) {
+            best = t;
+        }
+    }
+
+    vector<bool> emitted(triCount, false);
+    vector<int> cache;
+    vector<int> nextCache;
+    size_t cursor = 0;
+    while (true) {
+        const ivec3& tri = tris[best];
+        emitted[best] = true;
+        dest->push_back(tri);
+
+        // Retire the triangle from the lists of its vertices.
+        for (int c = 0; c < 3; ++c) {
+            VertexState& v = verts[tri[c]];
+            size_t* first = &adjacency[v.FirstTri];
+            size_t* last = first + v.Remaining - 1;
+            while (*first != best) {
+                ++first;
+            }
+            std::swap(*first, *last);
+            v.Remaining--;
+        }
+
+        // Move its vertices to the front of the cache, and rescore every
+        // vertex whose position changed, including the ones that fell out.
+        nextCache.assign(&tri.x, &tri.x + 3);
+        FOR_EACH(i, cache) {
+            if (*i != tri.x && *i != tri.y && *i != tri.z) {
+                nextCache.push_back(*i);
+            }
+        }
+        for (size_t i = 0; i < nextCache.size(); ++i) {
+            VertexState& v = verts[nextCache[i]];
+            v.CachePos = i < ModelCacheSize ? int(i) : -1;
+            float score = _ScoreVertex(v.CachePos, v.Remaining);
+            float delta = score - v.Score;
+            for (size_t j = 0; j < v.Remaining; ++j) {
+                triScores[adjacency[v.FirstTri + j]] += delta;
+            }
+            v.Score = score;
+        }
+        if (nextCache.size() > ModelCacheSize) {
+            nextCache.resize(ModelCacheSize);
+        }
+        cache.swap(nextCache);
+
+        // Pick the next triangle.
+        bool found = false;
+        float bestScore = 0;
+        FOR_EACH(i, cache) {
+            const VertexState& v = verts[*i];
+            for (size_t j = 0; j < v.Remaining; ++j) {
+                size_t t = adjacency[v.FirstTri + j];
+                if (!found || triScores[t] > bestScore) {
+                    best = t;
+                    bestScore = triScores[t];
+                    found = true;
+                }
+            }
+        }
+        if (!found) {
+            while (cursor < triCount && emitted[cursor]) {
+                ++cursor;
+            }
+            if (cursor == triCount) {
+                break;
+            }
+            best = cursor;
+        }
+    }
+}
+
+float
+VertexCacheUtil::GetAcmr(const TriList& tris,
+                         size_t vertexCount)
+{
+    if (tris.empty()) {
+        return 0;
+    }
+
+    // A vertex is cached if fewer than SimulatedCacheSize misses happened
+    // since its own; zero means it was never loaded.
+    vector<size_t> loadedAt(vertexCount, 0);
+    size_t misses = 0;
+    FOR_EACH(tri, tris) {
+        for (int c = 0; c < 3; ++c) {
+            size_t& loaded = loadedAt[(*tri)[c]];
+            if (loaded == 0 || misses - loaded >= SimulatedCacheSize) {
+                loaded = ++misses;
+            }
+        }
+    }
+    return float(misses) / tris.size();
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "common/typedefs.h"
+
+// Triangle reordering for the post-transform vertex cache, after Tom
+// Forsyth's "Linear-Speed Vertex Cache Optimisation".
+namespace VertexCacheUtil
+{
+    // Writes the triangles to dest in a cache-friendly order; their
+    // winding is preserved.  Every index must be less than vertexCount.
+    void Optimize(const TriList& tris,
+                  size_t vertexCount,
+                  TriList* dest);
+
+    // Average number of vertex shader invocations per triangle, with a
+    // simulated FIFO cache of typical size.  Ranges from 0.5 for an
+    // ideal mesh to 3 when no vertex is ever reused.
+    float GetAcmr(const TriList& tris,
+                  size_t vertexCount);
+}
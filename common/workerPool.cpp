@@ -0,0 +1,215 @@
+#include "common/workerPool.h"
+
+WorkerPool* WorkerPool::_instance = 0;
+
+WorkerPool&
+WorkerPool::GetInstance()
+{
+    if (not _instance) {
+        unsigned int hardware = tthread::thread::hardware_concurrency();
+        _instance = new WorkerPool(hardware > 1 ? hardware - 1 : 0);
+    }
+    return *_instance;
+}
+
+WorkerPool::WorkerPool(unsigned int workerCount) :
+    _participantCount(workerCount + 1),
+    _job(0),
+    _arg(0),
+    _nextParticipant(0),
+    _pending(0),
+    _quit(false)
+{
+    for (unsigned int i = 0; i < workerCount; ++i) {
+        Worker* worker = new Worker;
+        worker->Pool = this;
+        worker->Thread = new tthread::thread(_WorkerMain, worker);
+        _workers.push_back(worker);
+    }
+}
+
+// Tasks that never started are marked ready, so that their futures can
+// still be deleted; running tasks finish before their worker is joined.
+WorkerPool::~WorkerPool()
+{
+    _mutex.lock();
+    _quit = true;
+    while (not _tasks.empty()) {
+        Future* future = _tasks.front();
+        _tasks.pop_front();
+        future->_cancelled = true;
+        future->_ready = true;
+    }
+    _wake.notify_all();
+    _done.notify_all();
+    _mutex.unlock();
+
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        _workers[i]->Thread->join();
+        delete _workers[i]->Thread;
+        delete _workers[i];
+    }
+}
+
+void
+WorkerPool::Run(Job job, void* arg)
+{
+    tthread::lock_guard<tthread::mutex> guard(_runMutex);
+    const unsigned int participants = GetParticipantCount();
+
+    _mutex.lock();
+    _job = job;
+    _arg = arg;
+    _nextParticipant = 0;
+    _pending = participants;
+    _wake.notify_all();
+
+    while (_nextParticipant < participants) {
+        unsigned int participant = _nextParticipant++;
+        _mutex.unlock();
+        job(arg, participant);
+        _mutex.lock();
+        --_pending;
+    }
+    while (_pending) {
+        _done.wait(_mutex);
+    }
+    _job = 0;
+    _mutex.unlock();
+}
+
+WorkerPool::Future*
+WorkerPool::Submit(Task task, void* arg)
+{
+    Future* future = new Future(this, task, arg);
+    if (_workers.empty()) {
+        task(arg, future);
+        future->_ready = true;
+        return future;
+    }
+
+    _mutex.lock();
+    _tasks.push_back(future);
+    _wake.notify_one();
+    _mutex.unlock();
+    return future;
+}
+
+// Workers sleep until there's an unclaimed participant of the current job
+// or a queued task, so a spurious wake-up never runs anything twice.
+void
+WorkerPool::_WorkerMain(void* arg)
+{
+    Worker* worker = (Worker*) arg;
+    WorkerPool* pool = worker->Pool;
+    const unsigned int participants = pool->GetParticipantCount();
+
+    pool->_mutex.lock();
+    while (true) {
+        bool hasJob = pool->_job && pool->_nextParticipant < participants;
+        while (not hasJob && pool->_tasks.empty() && not pool->_quit) {
+            pool->_wake.wait(pool->_mutex);
+            hasJob = pool->_job && pool->_nextParticipant < participants;
+        }
+        if (pool->_quit) {
+            break;
+        }
+
+        if (hasJob) {
+            unsigned int participant = pool->_nextParticipant++;
+            Job job = pool->_job;
+            void* jobArg = pool->_arg;
+            pool->_mutex.unlock();
+
+            job(jobArg, participant);
+
+            pool->_mutex.lock();
+            if (--pool->_pending == 0) {
+                pool->_done.notify_all();
+            }
+            continue;
+        }
+
+        Future* future = pool->_tasks.front();
+        pool->_tasks.pop_front();
+        pool->_mutex.unlock();
+
+        future->_task(future->_arg, future);
+
+        pool->_mutex.lock();
+        future->_ready = true;
+        pool->_done.notify_all();
+    }
+    pool->_mutex.unlock();
+}
+
+WorkerPool::Future::Future(WorkerPool* pool, Task task, void* arg) :
+    _pool(pool),
+    _task(task),
+    _arg(arg),
+    _progress(0),
+    _cancelled(false),
+    _ready(false)
+{
+}
+
+WorkerPool::Future::~Future()
+{
+    Cancel();
+    Wait();
+}
+
+bool
+WorkerPool::Future::IsReady() const
+{
+    tthread::lock_guard<tthread::mutex> guard(_pool->_mutex);
+    return _ready;
+}
+
+void
+WorkerPool::Future::Wait()
+{
+    tthread::lock_guard<tthread::mutex> guard(_pool->_mutex);
+    while (not _ready) {
+        _pool->_done.wait(_pool->_mutex);
+    }
+}
+
+float
+WorkerPool::Future::GetProgress() const
+{
+    tthread::lock_guard<tthread::mutex> guard(_pool->_mutex);
+    return _progress;
+}
+
+void
+WorkerPool::Future::SetProgress(float progress)
+{
+    tthread::lock_guard<tthread::mutex> guard(_pool->_mutex);
+    _progress = progress;
+}
+
+void
+WorkerPool::Future::Cancel()
+{
+    tthread::lock_guard<tthread::mutex> guard(_pool->_mutex);
+    if (_ready) {
+        return;
+    }
+    _cancelled = true;
+    std::deque<Future*>& tasks = _pool->_tasks;
+    for (std::deque<Future*>::iterator i = tasks.begin(); i != tasks.end(); ++i) {
+        if (*i == this) {
+            tasks.erase(i);
+            _ready = true;
+            break;
+        }
+    }
+}
+
+bool
+WorkerPool::Future::IsCancelled() const
+{
+    tthread::lock_guard<tthread::mutex> guard(_pool->_mutex);
+    return _cancelled;
+}
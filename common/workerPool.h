@@ -0,0 +1,106 @@
+#pragma once
+#include "tthread/tinythread.h"
+#include <deque>
+#include <vector>
+
+// Fixed set of threads that run two kinds of work.  A job is a function
+// that every participant (each worker plus the calling thread) runs once;
+// the participants split the work among themselves, typically by their
+// participant index.  A task is a long-running function, such as building
+// a mesh, that runs once on whichever worker is free and is tracked
+// through a Future.  Workers always take a waiting job before a task.
+class WorkerPool {
+public:
+    typedef void (*Job)(void* arg, unsigned int participant);
+
+    class Future;
+    typedef void (*Task)(void* arg, Future* future);
+
+    // Handle to a submitted task.  The task reports its progress and polls
+    // for cancellation through it; the submitter polls for completion.
+    // Deleting a future cancels its task and waits for it to finish.
+    class Future {
+    public:
+        ~Future();
+
+        // True once the task has returned, or was cancelled before it
+        // started.
+        bool IsReady() const;
+        void Wait();
+
+        // Fraction of the task that's done, as last reported by the task.
+        float GetProgress() const;
+        void SetProgress(float progress);
+
+        // A task that hasn't started yet never runs; one that has started
+        // should return early when it sees IsCancelled.
+        void Cancel();
+        bool IsCancelled() const;
+
+    private:
+        friend class WorkerPool;
+        Future(WorkerPool* pool, Task task, void* arg);
+
+        WorkerPool* _pool;
+        Task _task;
+        void* _arg;
+        float _progress;
+        bool _cancelled;
+        bool _ready;
+
+        Future(const Future&);
+        Future& operator=(const Future&);
+    };
+
+    // Shared pool with one participant per hardware thread.
+    static WorkerPool&
+    GetInstance();
+
+    WorkerPool(unsigned int workerCount);
+    ~WorkerPool();
+
+    // Workers plus the calling thread.
+    unsigned int
+    GetParticipantCount() const { return _participantCount; }
+
+    // Runs the job on every participant and returns once all of them are
+    // done.  Each participant index is claimed by exactly one thread, which
+    // may be the calling thread, so workers that are busy with tasks never
+    // hold up a job.  Jobs submitted from different threads are
+    // serialized, so a job must not call Run.
+    void
+    Run(Job job, void* arg);
+
+    // Queues the task and returns immediately.  Tasks start in the order
+    // they were submitted.  The caller owns the returned future.
+    Future*
+    Submit(Task task, void* arg);
+
+private:
+    struct Worker {
+        WorkerPool* Pool;
+        tthread::thread* Thread;
+    };
+
+    static void _WorkerMain(void* arg);
+
+    static WorkerPool* _instance;
+
+    // Set before any worker starts, since workers read it unlocked.
+    const unsigned int _participantCount;
+
+    std::vector<Worker*> _workers;
+    std::deque<Future*> _tasks;
+    tthread::mutex _runMutex;
+    tthread::mutex _mutex;
+    tthread::condition_variable _wake;
+    tthread::condition_variable _done;
+    Job _job;
+    void* _arg;
+    unsigned int _nextParticipant;
+    unsigned int _pending;
+    bool _quit;
+
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+};
@@ -45,11 +45,11 @@ BuildingGrowth::Init()
     CoplanarPath* roof = rect;
     CoplanarPath* wall;
 
-    wall = dynamic_cast<CoplanarPath*>(walls[1]);
+    wall = AsCoplanar(walls[1]);
     rect = _sketch->AddInscribedRectangle(1, 1.5, wall, vec2(0, 0));
     _sketch->PushPath(rect, -0.5);
 
-    wall = dynamic_cast<CoplanarPath*>(walls[2]);
+    wall = AsCoplanar(walls[2]);
 
     sketch::PathList cylinders;
 
@@ -61,7 +61,7 @@ BuildingGrowth::Init()
     _sketch->PushPaths(cylinders, 3);
     PathList inners;
     FOR_EACH(circle, cylinders) {
-        CoplanarPath* outer = dynamic_cast<CoplanarPath*>(*circle);
+        CoplanarPath* outer = AsCoplanar(*circle);
         CoplanarPath* inner = _sketch->AddInscribedPolygon(0.15, outer, vec2(0, 0), 8);
         inners.push_back(inner);
     }
@@ -95,7 +95,11 @@ BuildingGrowth::Init()
     _tess->PullFromScene();
 
     Programs& progs = Programs::GetInstance();
-    progs.Load("Sketch.Facets", true);
+    if (Tessellator::DefaultFacets) {
+        progs.Load("Sketch.Flat", "Sketch.Facets.FS", "Sketch.Flat.VS");
+    } else {
+        progs.Load("Sketch.Facets", true);
+    }
 }
 
 void
@@ -126,9 +130,9 @@ BuildingGrowth::Draw()
     Programs& progs = Programs::GetInstance();
     PerspCamera surfaceCam = GetContext()->mainCam;
 
-    glUseProgram(progs["Sketch.Facets"]);
+    glUseProgram(progs[Tessellator::DefaultFacets ? "Sketch.Flat" : "Sketch.Facets"]);
     surfaceCam.Bind(glm::mat4());
     
     _vao.Bind();
-    glDrawElements(GL_TRIANGLES, _vao.indexCount, GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, _vao.indexCount, _vao.indexType, 0);
 }
@@ -3,9 +3,152 @@
 #include "common/init.h"
 #include "glm/gtx/constants.inl"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
 using namespace std;
 using namespace glm;
 
+// Tetrahedralization takes seconds per template and its inputs never change
+// from one run to the next, so its results are cached on disk, in a file per
+// template named after a hash of its TetCacheKey.
+static const bool CacheTets = true;
+static const char* TetCacheFile = "data/tets-%8.8x.bin";
+
+// Bump this whenever the cached data would come out differently.
+static const unsigned int TetCacheVersion = 2;
+
+// Everything that the tets of a template depend on.  Zeroed before it's
+// filled in, so that it can be hashed and compared bytewise.
+struct TetCacheKey {
+    unsigned int Version;
+    int NumSides;
+    float Thickness;
+    float TopRadius;
+    float TetSize;
+    float InsetDepth;
+    int WindowRows;
+    int WindowColumns;
+    float WindowWidth;
+    float WindowHeight;
+    char Switches[64];
+};
+
+// Layout of a cache file: the key, this header, then the centroids, the
+// flattened triangles, and the cracks.  The tets themselves aren't needed to
+// draw a template, so they aren't kept.
+struct TetCacheHeader {
+    int TotalTetCount;
+    int BoundaryTetCount;
+    unsigned int CentroidCount;
+    unsigned int FlattenedTetBytes;
+    unsigned int CrackBytes;
+};
+
+static TetCacheKey
+_GetTetCacheKey(const ThreadParams& params, const string& switches)
+{
+    TetCacheKey key;
+    memset(&key, 0, sizeof(key));
+    key.Version = TetCacheVersion;
+    key.NumSides = params.NumSides;
+    key.Thickness = params.Thickness;
+    key.TopRadius = params.TopRadius;
+    key.TetSize = params.TetSize;
+    key.InsetDepth = params.InsetDepth;
+    key.WindowRows = params.Windows.Rows;
+    key.WindowColumns = params.Windows.Columns;
+    key.WindowWidth = params.Windows.Size.x;
+    key.WindowHeight = params.Windows.Size.y;
+    strncpy(key.Switches, switches.c_str(), sizeof(key.Switches) - 1);
+    return key;
+}
+
+// FNV-1a of the key's bytes.
+static string
+_GetTetCacheFilename(const TetCacheKey& key)
+{
+    unsigned int hash = 2166136261u;
+    const unsigned char* bytes = (const unsigned char*) &key;
+    for (size_t i = 0; i < sizeof(key); ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    char filename[64];
+    sprintf(filename, TetCacheFile, hash);
+    return filename;
+}
+
+static void
+_AppendBytes(const void* src, size_t count, Blob* dest)
+{
+    const unsigned char* bytes = (const unsigned char*) src;
+    dest->insert(dest->end(), bytes, bytes + count);
+}
+
+static void
+_SaveTets(const TetCacheKey& key,
+          const BuildingTemplate& templ,
+          const GpuParams& gpuData)
+{
+    TetCacheHeader header;
+    header.TotalTetCount = templ.TotalTetCount;
+    header.BoundaryTetCount = templ.BoundaryTetCount;
+    header.CentroidCount = gpuData.Centroids.size();
+    header.FlattenedTetBytes = gpuData.FlattenedTets.size();
+    header.CrackBytes = gpuData.Cracks.size();
+
+    Blob blob;
+    _AppendBytes(&key, sizeof(key), &blob);
+    _AppendBytes(&header, sizeof(header), &blob);
+    _AppendBytes(gpuData.Centroids.empty() ? NULL : &gpuData.Centroids[0],
+                 sizeof(vec4) * header.CentroidCount, &blob);
+    _AppendBytes(gpuData.FlattenedTets.empty() ? NULL : &gpuData.FlattenedTets[0],
+                 header.FlattenedTetBytes, &blob);
+    _AppendBytes(gpuData.Cracks.empty() ? NULL : &gpuData.Cracks[0],
+                 header.CrackBytes, &blob);
+    WriteBinaryFile(_GetTetCacheFilename(key), blob);
+}
+
+// Returns false if there's no usable cache file for the given key.
+static bool
+_LoadTets(const TetCacheKey& key,
+          BuildingTemplate* templ,
+          GpuParams* gpuData)
+{
+    string filename = _GetTetCacheFilename(key);
+    Blob blob;
+    ReadBinaryFile(filename, &blob);
+    if (blob.empty()) {
+        return false;
+    }
+
+    TetCacheHeader header;
+    size_t offset = sizeof(key) + sizeof(header);
+    if (blob.size() < offset || memcmp(&blob[0], &key, sizeof(key))) {
+        printf("Ignoring stale %s\n", filename.c_str());
+        return false;
+    }
+    memcpy(&header, &blob[sizeof(key)], sizeof(header));
+    size_t centroidBytes = sizeof(vec4) * header.CentroidCount;
+    if (blob.size() != offset + centroidBytes + header.FlattenedTetBytes + header.CrackBytes) {
+        printf("Ignoring truncated %s\n", filename.c_str());
+        return false;
+    }
+
+    templ->TotalTetCount = header.TotalTetCount;
+    templ->BoundaryTetCount = header.BoundaryTetCount;
+    const vec4* centroids = (const vec4*) (&blob[0] + offset);
+    gpuData->Centroids.assign(centroids, centroids + header.CentroidCount);
+    offset += centroidBytes;
+    gpuData->FlattenedTets.assign(blob.begin() + offset,
+                                  blob.begin() + offset + header.FlattenedTetBytes);
+    offset += header.FlattenedTetBytes;
+    gpuData->Cracks.assign(blob.begin() + offset,
+                           blob.begin() + offset + header.CrackBytes);
+    return true;
+}
+
 static void
 _CreateExteriorWall(
     float r1,
@@ -119,7 +262,7 @@ _CreateExteriorWall(
 }
 
 void
-GenerateBuilding(void* vParams)
+GenerateBuilding(void* vParams, WorkerPool::Future* future)
 {
     ThreadParams* params = (ThreadParams*) vParams;
     float thickness = params->Thickness;
@@ -145,6 +288,17 @@ GenerateBuilding(void* vParams)
         return;
     }
 
+    // Skip straight to the results if a previous run already has them
+    const float qualityBound = 1.414;
+    const float maxVolume = tetSize;
+    string switches = TetUtil::TetgenSwitches(qualityBound, maxVolume, true);
+    TetCacheKey key = _GetTetCacheKey(*params, switches);
+    if (CacheTets && _LoadTets(key, dest, gpuData)) {
+        params->GpuData = gpuData;
+        return;
+    }
+    future->SetProgress(0.1f);
+
     // Add inner walls
     y1 += thickness; y2 -= thickness;
     r1 -= thickness; r2 -= thickness;
@@ -155,11 +309,19 @@ GenerateBuilding(void* vParams)
     holePoints.push_back(vec3(0, 10.0, 0));
     TetUtil::AddHoles(holePoints, &in);
 
-    // Tetrahedralize the boundary mesh
+    // Tetrahedralize the boundary mesh.  Tetgen can't be interrupted, so
+    // cancellation is only noticed on either side of it.
     tetgenio out;
-    const float qualityBound = 1.414;
-    const float maxVolume = tetSize;
+    if (future->IsCancelled()) {
+        delete gpuData;
+        return;
+    }
     TetUtil::TetsFromHull(in, &out, qualityBound, maxVolume, true);
+    if (future->IsCancelled()) {
+        delete gpuData;
+        return;
+    }
+    future->SetProgress(0.8f);
     dest->TotalTetCount = out.numberoftetrahedra;
 
     // Populate the per-tet texture data and move boundary tets to the front
@@ -172,40 +334,93 @@ GenerateBuilding(void* vParams)
     // Non-indexed vertical crack lines
     TetUtil::FindCracks(out, gpuData->Centroids, &gpuData->Cracks);
 
+    if (CacheTets) {
+        _SaveTets(key, *dest, *gpuData);
+    }
     params->GpuData = gpuData;
 }
 
-void
-UploadBuilding(ThreadParams& params)
+// Counts an upload towards both the caller's budget and the frame's total.
+static void
+_SpendBudget(size_t byteCount, size_t* byteBudget)
+{
+    *byteBudget -= std::min(byteCount, *byteBudget);
+    Vao::frameBytesUploaded += byteCount;
+}
+
+bool
+UploadBuilding(ThreadParams& params, size_t* byteBudget)
 {
     GpuParams* src = params.GpuData;
     BuildingTemplate* dest = params.Dest;
+    pezCheck(src != 0, "Building template has no data to upload");
+
+    // Each piece is sent whole, so don't start one on a spent budget
+    if (!*byteBudget) {
+        return false;
+    }
 
     // Cheap Vao for buildings that aren't self-destructing
-    dest->HullVao.Init();
-    dest->HullVao.AddVertexAttribute(AttrPosition,
-                                     3,
-                                     src->HullPoints);
-    dest->HullVao.AddIndices(src->HullIndices);
+    if (!dest->HasHull) {
+        dest->HullVao.Init();
+        dest->HullVao.AddVertexAttribute(AttrPosition,
+                                         3,
+                                         src->HullPoints);
+        dest->HullVao.AddIndices(src->HullIndices);
+        dest->HasHull = true;
+        _SpendBudget(src->HullPoints.size() + src->HullIndices.size(), byteBudget);
+    }
 
     if (params.CanExplode) {
-        // Texture buffer with centroids
-        dest->CentroidTexture.Init(src->Centroids);
 
-        // Huge buffer of non-indexed triangles
-        dest->BuildingVao.Init();
+        // Huge buffer of non-indexed triangles, allocated up front and
+        // filled over as many frames as the budget requires
         VertexAttribMask attribs = AttrPositionFlag | AttrNormalFlag;
-        dest->BuildingVao.AddInterleaved(attribs, src->FlattenedTets);
-        pezCheckGL("Bigass VBO for tets");
+        const Blob& tets = src->FlattenedTets;
+        if (!dest->BuildingVao.vao) {
+            dest->BuildingVao.Init();
+            glBindVertexArray(dest->BuildingVao.vao);
+            glGenBuffers(1, &dest->BuildingVao.vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, dest->BuildingVao.vbo);
+            glBufferData(GL_ARRAY_BUFFER, tets.size(), NULL, GL_STATIC_DRAW);
+            Vao::SetInterleavedPointers(attribs);
+            dest->BuildingVao.vertexCount = tets.size() / Vao::GetStride(attribs);
+            Vao::totalBytesBuffered += tets.size();
+        }
+        if (params.UploadedTetBytes < tets.size()) {
+            size_t count = std::min(tets.size() - params.UploadedTetBytes, *byteBudget);
+            if (count) {
+                glBindBuffer(GL_ARRAY_BUFFER, dest->BuildingVao.vbo);
+                glBufferSubData(GL_ARRAY_BUFFER,
+                                params.UploadedTetBytes,
+                                count,
+                                &tets[params.UploadedTetBytes]);
+                params.UploadedTetBytes += count;
+                _SpendBudget(count, byteBudget);
+            }
+            pezCheckGL("Bigass VBO for tets");
+            if (params.UploadedTetBytes < tets.size()) {
+                return false;
+            }
+        }
+        if (!*byteBudget) {
+            return false;
+        }
+
+        // Texture buffer with centroids
+        dest->CentroidTexture.Init(src->Centroids);
 
         // Non-indexed vertical crack lines
         dest->CracksVao.Init();
         dest->CracksVao.AddInterleaved(AttrPositionFlag | AttrLengthFlag, src->Cracks);
         dest->NumCracks = (src->Cracks.size() / sizeof(vec4)) / 2;
         pezCheckGL("Bigass VBO for cracks");
+        _SpendBudget(sizeof(vec4) * src->Centroids.size() + src->Cracks.size(), byteBudget);
+        dest->HasTets = true;
     }
 
     // Free CPU memory
     delete src;
     params.GpuData = 0;
+    return true;
 }
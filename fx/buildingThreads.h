@@ -1,6 +1,6 @@
 #pragma once
 #include "fx/buildings.h"
-#include "tthread/tinythread.h"
+#include "common/workerPool.h"
 
 struct GpuParams {
     Blob HullIndices;
@@ -26,10 +26,16 @@ struct ThreadParams {
     WindowParams Windows;
     BuildingTemplate* Dest;
     GpuParams* GpuData;
+    size_t UploadedTetBytes;
 };
 
-/// Executes on a worker thread, performs no OpenGL calls.
-void GenerateBuilding(void* params);
+/// Executes as a WorkerPool task, performs no OpenGL calls.  Leaves
+/// GpuData null if the task is cancelled.
+void GenerateBuilding(void* params, WorkerPool::Future* future);
 
-/// Executes on the main thread when a worker thread completes.
-void UploadBuilding(ThreadParams& params);
+/// Executes on the main thread once the task completes.  Uploads the
+/// template a piece at a time, taking what it sends out of the budget, and
+/// returns true once the template is complete.  Nothing is sent once the
+/// budget is spent, but pieces other than the flattened tets are sent
+/// whole, so the budget can be overrun by one piece.
+bool UploadBuilding(ThreadParams& params, size_t* byteBudget);
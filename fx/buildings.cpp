@@ -24,6 +24,10 @@ using glm::mat3;
 using glm::vec3;
 using glm::vec2;
 
+// Template uploads are spread across frames so that none of them sends
+// more than this, give or take one of the smaller pieces.
+static const size_t UploadBytesPerFrame = 4 * 1024 * 1024;
+
 class CracksEffect : public Effect {
 public:
     CracksEffect(Buildings* buildings) : Effect(), _buildings(buildings) {}
@@ -44,6 +48,13 @@ Buildings::Buildings(bool explode) : Effect()
 
 Buildings::~Buildings()
 {
+    FOR_EACH(f, _futures) {
+        delete *f;
+    }
+    FOR_EACH(p, _threadParams) {
+        delete (*p)->GpuData;
+        delete *p;
+    }
     delete _cracks;
 }
 
@@ -61,16 +72,18 @@ Buildings::Init()
     // Populate the template parameters.  This should perhaps be moved to JSON.
     #include "fx/buildings.inl"
     
-    // Kick off the threads that tetify the building templates
+    // Kick off the tasks that tetify the building templates
+    WorkerPool& pool = WorkerPool::GetInstance();
     for (size_t i = 0; i < _threadParams.size(); ++i) {
-        _threads.push_back(new tthread::thread(GenerateBuilding,
-            _threadParams[i]));
+        _futures.push_back(pool.Submit(GenerateBuilding, _threadParams[i]));
     }
 
     // Allocate batches for each template
     _batches.resize(_templates.size());
     for (size_t i = 0; i < _templates.size(); ++i) {
         _batches[i].Template = &_templates[i];
+        _templates[i].HasHull = false;
+        _templates[i].HasTets = false;
     }
 
     // Stamp down the buildings in a grid
@@ -144,22 +157,45 @@ Buildings::Init()
 void
 Buildings::Update()
 {
-    // Wait for the tetrahedralization to finish
-    if (_threads.size()) {
-        printf("Waiting for tet threads to join...\n");
-        for (size_t i = 0; i < _threads.size(); ++i) {
-            _threads[i]->join();
+    // Upload each template as soon as its tetrahedralization finishes,
+    // without blocking the frame on the ones that haven't, and without
+    // sending more than UploadBytesPerFrame in any one frame
+    if (_futures.size()) {
+        size_t budget = UploadBytesPerFrame;
+        size_t pending = 0;
+        for (size_t i = 0; i < _futures.size(); ++i) {
+            if (!_futures[i]) {
+                continue;
+            }
+            if (!_futures[i]->IsReady()) {
+                ++pending;
+                continue;
+            }
+
+            // A cancelled task leaves nothing to upload; its template is
+            // simply never drawn
+            if (!_threadParams[i]->GpuData) {
+                delete _futures[i];
+                _futures[i] = 0;
+                continue;
+            }
+            if (!UploadBuilding(*_threadParams[i], &budget)) {
+                ++pending;
+                continue;
+            }
             if (_explode) {
-                printf("Thread %lu of %lu has completed.\n", i+1, _threads.size());
+                printf("Template %lu of %lu has completed.\n", i+1, _futures.size());
             }
-            UploadBuilding(*_threadParams[i]);
-            delete _threads[i];
+            delete _futures[i];
+            _futures[i] = 0;
         }
-        FOR_EACH(p, _threadParams) {
-            delete *p;
+        if (!pending) {
+            FOR_EACH(p, _threadParams) {
+                delete *p;
+            }
+            _futures.clear();
+            _threadParams.clear();
         }
-        _threads.clear();
-        _threadParams.clear();
     }
 
     const bool Looping = true;
@@ -197,11 +233,6 @@ Buildings::Update()
 void
 Buildings::Draw()
 {
-    // Don't draw until the tet threads have joined.
-    if (_threads.size()) {
-        return;
-    }
-
     glDisable(GL_BLEND);
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
@@ -244,10 +275,15 @@ Buildings::_DrawBuilding(BuildingTemplate& templ, BuildingInstance& instance)
     bool boundariesOnly = time < (instance.ExplosionStart - BulgeDuration);
     bool completelyDestroyed = (time > instance.ExplosionStart + ExplosionDuration);
 
-    if (completelyDestroyed) {
+    if (completelyDestroyed || !templ.HasHull) {
         return;
     }
 
+    // Stand in with the hull until the tets have been uploaded
+    if (!templ.HasTets) {
+        boundariesOnly = true;
+    }
+
     if (boundariesOnly) {
         glUseProgram(progs["Buildings.Facets"]);
     } else {
@@ -295,11 +331,6 @@ CracksEffect::Update()
 void
 CracksEffect::Draw()
 {
-    // Don't draw if the tet threads haven't joined yet.
-    if ( _buildings->_threads.size()) {
-        return;
-    }
-
     Programs& progs = Programs::GetInstance();
     PerspCamera surfaceCam = GetContext()->mainCam;
 
@@ -320,7 +351,7 @@ CracksEffect::_DrawBuilding(BuildingTemplate& templ, BuildingInstance& instance)
     const float ExplosionDuration = 1.5;
     bool completelyDestroyed = (time > instance.ExplosionStart + ExplosionDuration);
 
-    if (completelyDestroyed) {
+    if (completelyDestroyed || !templ.HasTets) {
         return;
     }
 
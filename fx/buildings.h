@@ -2,7 +2,7 @@
 #include "common/vao.h"
 #include "common/texture.h"
 #include "common/effect.h"
-#include "tthread/tinythread.h"
+#include "common/workerPool.h"
 
 struct BuildingTemplate {
     BufferTexture CentroidTexture;
@@ -12,6 +12,11 @@ struct BuildingTemplate {
     Vao CracksVao;
     Vao HullVao;
     int NumCracks;
+
+    // Set by UploadBuilding as the pieces of the template arrive.  Until
+    // HasTets, instances are drawn with HullVao alone.
+    bool HasHull;
+    bool HasTets;
 };
 
 struct BuildingInstance {
@@ -58,7 +63,7 @@ private:
     bool _explode;
 
     vector<ThreadParams*> _threadParams;
-    vector<tthread::thread*> _threads;
+    vector<WorkerPool::Future*> _futures;
 
     friend class CracksEffect;
 };
@@ -223,7 +223,7 @@ void CityGrowth::Init()
             e->Rect.SideWall.Path = shape->AddInscribedRectangle(
                 e->Height / 2,
                 e->Rect.Size.x * 0.9,
-                dynamic_cast<sketch::CoplanarPath*>(wall),
+                sketch::AsCoplanar(wall),
                 vec2(0, 0));
             e->Rect.SideWall.BeginW = e->Rect.SideWall.Path->Plane->Eqn.w;
             sketch::PathList secondaryWalls;
@@ -234,7 +234,7 @@ void CityGrowth::Init()
                 &secondaryWalls);
 
             e->Rect.SideWallRoof.Path = 
-                dynamic_cast<sketch::CoplanarPath*>(secondaryWalls[1]);
+                sketch::AsCoplanar(secondaryWalls[1]);
 
             e->Rect.SideWallRoof.EndW = e->Rect.SideWallRoof.Path->Plane->Eqn.w;
             e->Rect.SideWall.EndW = e->Rect.SideWall.Path->Plane->Eqn.w;
@@ -251,7 +251,7 @@ void CityGrowth::Init()
 
         if (e->HasWindows) {
             FOR_EACH(w, walls) {
-                sketch::CoplanarPath* cop = dynamic_cast<sketch::CoplanarPath*>(*w);
+                sketch::CoplanarPath* cop = sketch::AsCoplanar(*w);
                 vec2 extent = shape->GetPathExtent(cop);
                 float wallHeight = extent.x;
                 float wallWidth = extent.y;
@@ -322,6 +322,7 @@ void CityGrowth::Init()
         // Tessellate the final form of the building before collapsing it
         e->CpuShape = shape;
         e->CpuTriangles = new sketch::Tessellator(*shape);
+        e->CpuTriangles->EnableCacheOptimization(true);
         e->CpuTriangles->PullFromScene();
 
         // Collapse the secondary roof
@@ -333,33 +334,38 @@ void CityGrowth::Init()
 
         // Collapse the window frames
         FOR_EACH(p, e->WindowFrames.Paths) {
-            sketch::CoplanarPath* cop = dynamic_cast<sketch::CoplanarPath*>(*p);
+            sketch::CoplanarPath* cop = sketch::AsCoplanar(*p);
             e->WindowFrames.EndW.push_back(cop->Plane->Eqn.w);
         }
         shape->PushPaths(
             e->WindowFrames.Paths,
             -windowThickness);
         FOR_EACH(p, e->WindowFrames.Paths) {
-            sketch::CoplanarPath* cop = dynamic_cast<sketch::CoplanarPath*>(*p);
+            sketch::CoplanarPath* cop = sketch::AsCoplanar(*p);
             e->WindowFrames.BeginW.push_back(cop->Plane->Eqn.w);
         }
 
         // Collapse the windows
         FOR_EACH(p, e->Windows.Paths) {
-            sketch::CoplanarPath* cop = dynamic_cast<sketch::CoplanarPath*>(*p);
+            sketch::CoplanarPath* cop = sketch::AsCoplanar(*p);
             e->Windows.EndW.push_back(cop->Plane->Eqn.w);
         }
         shape->PushPaths(
             e->Windows.Paths,
             windowThickness/2);
         FOR_EACH(p, e->Windows.Paths) {
-            sketch::CoplanarPath* cop = dynamic_cast<sketch::CoplanarPath*>(*p);
+            sketch::CoplanarPath* cop = sketch::AsCoplanar(*p);
             e->Windows.BeginW.push_back(cop->Plane->Eqn.w);
         }
 
+        // Rig the windows and their frames for animation
+        _RigPaths(shape, &e->WindowFrames);
+        _RigPaths(shape, &e->Windows);
+
         // Collapse the main building vertically
         if (_config == GROW) {
-            shape->SetPathPlane(e->Roof.Path, e->Roof.BeginW);
+            shape->RigExtrusion(e->Roof.Path, &e->Roof.Rig);
+            shape->SetRigPlane(e->Roof.Rig, e->Roof.BeginW);
             e->Visible = false;
         }
 
@@ -378,12 +384,21 @@ void CityGrowth::Init()
 
         e->CpuTriangles->PullFromScene();
         e->CpuTriangles->PushToGpu(e->GpuTriangles);
+        if (Verbose) {
+            printf("ACMR %.2f -> %.2f\n",
+                   e->CpuTriangles->GetAcmrBefore(),
+                   e->CpuTriangles->GetAcmrAfter());
+        }
     }
 
     // Compile shaders
     Programs& progs = Programs::GetInstance();
     progs.Load("Buildings.Terrain", false);
-    progs.Load("Sketch.Facets", true);
+    if (sketch::Tessellator::DefaultFacets) {
+        progs.Load("Sketch.Flat", "Sketch.Facets.FS", "Sketch.Flat.VS");
+    } else {
+        progs.Load("Sketch.Facets", true);
+    }
 
     // Set up some growth state
     _stateStartTime = 0;
@@ -407,24 +422,8 @@ void CityGrowth::_UpdateDetail(float elapsedTime)
         anims.push_back(building.Rect.SideWall);
         anims.push_back(building.Rect.SideWallRoof);
     } else if (building.HasWindows) {
-        AnimArray& frames = building.WindowFrames;
-        for (size_t i = 0; i < frames.Paths.size(); ++i) {
-            AnimElement anim;
-            building.CpuShape->SetVisible(frames.Paths[i], true);
-            anim.Path = dynamic_cast<sketch::CoplanarPath*>(frames.Paths[i]);
-            anim.BeginW = frames.BeginW[i];
-            anim.EndW = frames.EndW[i];
-            anims.push_back(anim);
-        }
-        AnimArray& windows = building.Windows;
-        for (size_t i = 0; i < windows.Paths.size(); ++i) {
-            AnimElement anim;
-            building.CpuShape->SetVisible(windows.Paths[i], true);
-            anim.Path = dynamic_cast<sketch::CoplanarPath*>(windows.Paths[i]);
-            anim.BeginW = windows.BeginW[i];
-            anim.EndW = windows.EndW[i];
-            anims.push_back(anim);
-        }
+        building.CpuShape->SetVisible(building.WindowFrames.Paths, true);
+        building.CpuShape->SetVisible(building.Windows.Paths, true);
     } else if (building.SecondaryRoof.Path) {
         anims.push_back(building.SecondaryRoof);
     } else {
@@ -445,30 +444,58 @@ void CityGrowth::_UpdateDetail(float elapsedTime)
         building.CpuShape->SetPathPlane(a->Path, w);
     }
 
+    if (building.HasWindows && !building.Rect.SideWall.Path) {
+        _AnimatePaths(building.CpuShape, building.WindowFrames, elapsedTime);
+        _AnimatePaths(building.CpuShape, building.Windows, elapsedTime);
+    }
+
     building.CpuTriangles->PullFromScene();
     building.CpuTriangles->PushToGpu(building.GpuTriangles);
 }
 
+void CityGrowth::_RigPaths(sketch::Scene* shape, AnimArray* anims)
+{
+    anims->Rigs.resize(anims->Paths.size());
+    for (size_t i = 0; i < anims->Paths.size(); ++i) {
+        sketch::CoplanarPath* cop = sketch::AsCoplanar(anims->Paths[i]);
+        shape->RigExtrusion(cop, &anims->Rigs[i]);
+    }
+}
+
+void CityGrowth::_AnimatePaths(sketch::Scene* shape, const AnimArray& anims, float elapsedTime)
+{
+    if (anims.Rigs.empty()) {
+        return;
+    }
+    tween::Elastic tweener;
+    FloatList ws(anims.Rigs.size());
+    for (size_t i = 0; i < ws.size(); ++i) {
+        ws[i] = tweener.easeOut(
+            elapsedTime,
+            anims.BeginW[i],
+            anims.EndW[i] - anims.BeginW[i],
+            SecondsPerBuilding);
+    }
+    shape->SetRigPlanes(&anims.Rigs[0], &ws[0], ws.size());
+}
+
 void CityGrowth::_UpdateGrowth(float elapsedTime)
 {
     CityElement& building = _elements[_currentBuildingIndex];
     building.Visible = true;
 
-    vector<AnimElement> anims;
-    anims.push_back(building.Roof);
     if (elapsedTime > SecondsPerBuilding) {
         elapsedTime = SecondsPerBuilding;
     }
 
     tween::Elastic tweener;
-    FOR_EACH(a, anims) {
-        float w = tweener.easeOut(
-            elapsedTime,
-            a->BeginW,
-            a->EndW - a->BeginW,
-            SecondsPerBuilding);
-        building.CpuShape->SetPathPlane(a->Path, w);
-    }
+    const AnimElement& roof = building.Roof;
+    float w = tweener.easeOut(
+        elapsedTime,
+        roof.BeginW,
+        roof.EndW - roof.BeginW,
+        SecondsPerBuilding);
+    building.CpuShape->SetRigPlane(roof.Rig, w);
 
     building.CpuTriangles->PullFromScene();
     building.CpuTriangles->PushToGpu(building.GpuTriangles);
@@ -622,7 +649,7 @@ void CityGrowth::Draw()
     }
 
     glDisable(GL_CULL_FACE);
-    glUseProgram(progs["Sketch.Facets"]);
+    glUseProgram(progs[sketch::Tessellator::DefaultFacets ? "Sketch.Flat" : "Sketch.Facets"]);
     glUniform3f(u("Scale"), 1, 1, 1);
     glUniform3f(u("Translate"), 0, 0, 0);
 
@@ -634,7 +661,7 @@ void CityGrowth::Draw()
         mat4 xlate = glm::translate(e->Position);
         _camera.Bind(xlate);
         glUniform1i(u("Smooth"), e->NumSides > 5 ? 1 : 0);
-        glDrawElements(GL_TRIANGLES, e->GpuTriangles.indexCount, GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, e->GpuTriangles.indexCount, e->GpuTriangles.indexType, 0);
     }
 }
 
@@ -11,12 +11,14 @@ struct AnimElement {
     sketch::CoplanarPath* Path;
     float BeginW;
     float EndW;
+    sketch::ExtrusionRig Rig;
 };
 
 struct AnimArray {
     sketch::PathList Paths;
     FloatList BeginW;
     FloatList EndW;
+    std::vector<sketch::ExtrusionRig> Rigs;
 };
 
 struct RectElement {
@@ -61,6 +63,8 @@ protected:
     void _UpdateGrowth(float elapsedTime); 
     void _UpdateDetail(float elapsedTime);
     void _UpdateFlight(float elapsedTime);
+    void _RigPaths(sketch::Scene* shape, AnimArray* anims);
+    void _AnimatePaths(sketch::Scene* shape, const AnimArray& anims, float elapsedTime);
     bool _Collides(const CityElement& e) const;
     PerspCamera _InitialCamera();
 private:
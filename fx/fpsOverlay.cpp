@@ -146,6 +146,8 @@ FpsOverlay::Draw()
         int kb = (info.usmblks + info.uordblks) / 1024;
         #endif
         ssdigits << kb;
+    } else if (_mode == UploadUsage) {
+        ssdigits << Vao::lastFrameBytesUploaded / 1024;
     } else {
         ssdigits << int(round(_fps));
     }
@@ -177,6 +179,7 @@ FpsOverlay::Draw()
     glBindVertexArray(_vao);
     glBindBuffer(GL_ARRAY_BUFFER, _vbo);
     glBufferSubData(GL_ARRAY_BUFFER, 0, BytesPerDigit * numDigits, &vbo[0]);
+    Vao::frameBytesUploaded += BytesPerDigit * numDigits;
     _numerals.Bind();
 
     glEnable(GL_BLEND);
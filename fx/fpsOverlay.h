@@ -30,6 +30,7 @@ public:
     enum Mode {
         FrameRate,
         MemUsage,
+        UploadUsage,    // KiB copied into GPU buffers during the last frame
     };
 
     FpsOverlay(Mode m = FrameRate) : Effect(), _mode(m) {}
@@ -17,6 +17,7 @@
 #include "tween/CppTweener.h"
 
 #include <algorithm>
+#include <cstring>
 #include <limits>
 
 using namespace std;
@@ -36,6 +37,63 @@ static const bool VisualizeCell = false;
 static const bool PopBuildings = true;
 static const bool HasWindows = false;
 
+// Play the centerpiece back from a BakedPlayback, so that it costs no
+// geometry work per frame.  Steps are baked at 24 Hz of the default
+// half-second commands, which takes a moment at startup and comes to about
+// eighteen megabytes of vertices, so it's off unless frames are short.
+static const bool BakedCenterpiece = false;
+static const unsigned int CenterpieceBakeSteps = 12;
+
+// Set BakeCity to regenerate BakedCityFile; the city is loaded from the
+// file whenever it exists and matches the grid.
+static const bool BakeCity = false;
+static const char* BakedCityFile = "data/gridCity.bin";
+
+// Bump this whenever _BuildCell would build different shapes from the same
+// cells, or the layout of BakedCityFile changes.
+static const unsigned int BakedCityVersion = 1;
+
+// Layout of BakedCityFile: this header, a scene image for the ridges, then a
+// BakedCell and a scene image for each cell.  Paths are stored as indices;
+// see sketch::Scene::GetPath.  The cell hash covers the quad and height of
+// every cell, which is all that _BuildCell takes from the generator, so any
+// change to the noise, the terraces or the terrain makes the file stale.
+struct BakedCityHeader {
+    unsigned int Version;
+    unsigned int NumCells;
+    unsigned int CellHash;
+    unsigned int HasWindows;
+};
+
+struct BakedCell {
+    unsigned int Roof;
+    float BeginW;
+    float EndW;
+    unsigned int Ridges[4];
+    float RidgeBeginW[4];
+    float RidgeEndW[4];
+};
+static const unsigned int NoRidge = ~0u;
+
+// FNV-1a of the quads and heights of the cells.
+static unsigned int
+_HashCells(const GridCells& cells)
+{
+    unsigned int hash = 2166136261u;
+    FOR_EACH(cell, cells) {
+        const float values[10] = {
+            cell->Quad.p.x, cell->Quad.p.y, cell->Quad.p.z,
+            cell->Quad.u.x, cell->Quad.u.y, cell->Quad.u.z,
+            cell->Quad.v.x, cell->Quad.v.y, cell->Quad.v.z,
+            cell->Height };
+        const unsigned char* bytes = (const unsigned char*) values;
+        for (size_t i = 0; i < sizeof(values); ++i) {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+    }
+    return hash;
+}
+
 // Params: int octaves, float freq, float amp, int seed
 static Perlin HeightNoise(2, .5, 1, 3);
 static Perlin PerturbNoiseY(2, .5, 1, 5);
@@ -82,7 +140,8 @@ GridTerrainFunc(vec2 v)
     return p;
 }
 
-GridCity::GridCity()
+GridCity::GridCity() :
+    _cellPool(sketch::Tessellator::DefaultFacets ? sketch::Tessellator::FacetAttribs : AttrPositionFlag)
 {
     centerVines = false;
     outerVines = true;
@@ -388,6 +447,7 @@ Vao GridCity::_CreateCityWall()
 
     sketch::Tessellator tess(shape);
     Vao vao;
+    tess.EnableCacheOptimization(true);
     tess.PullFromScene();
     tess.PushToGpu(vao);
 
@@ -405,7 +465,6 @@ void GridCity::Init()
     }
 
     _ridges.Shape = new sketch::Scene();
-    _ridges.CpuTriangles = new sketch::Tessellator(*_ridges.Shape);
 
     // Tessellate the ground
     FloatList ground;
@@ -604,12 +663,40 @@ void GridCity::Init()
         cell.Quad.v = length(cell.Quad.v) * normalize(p2 - cell.Quad.p);
     }
 
+    // Load the baked city if there is one
+    BakedCityHeader header;
+    header.Version = BakedCityVersion;
+    header.NumCells = _cells.size();
+    header.CellHash = _HashCells(_cells);
+    header.HasWindows = HasWindows;
+    Blob baked;
+    if (!BakeCity) {
+        ReadBinaryFile(BakedCityFile, &baked);
+    }
+    if (!baked.empty()) {
+        if (baked.size() < sizeof(header) ||
+            memcmp(&baked[0], &header, sizeof(header))) {
+            printf("Ignoring stale %s\n", BakedCityFile);
+            baked.clear();
+        } else if (!_LoadCity(baked, sizeof(header))) {
+            printf("Ignoring damaged %s\n", BakedCityFile);
+            baked.clear();
+        }
+    }
+
     // Seed the sketch objects
+    Blob bakedCells;
     {
         int row = 0;
         int col = 0;
         FOR_EACH(i, _cells) {
             GridCell& cell = *i;
+            if (baked.empty()) {
+                _BuildCell(&cell);
+                if (BakeCity) {
+                    _BakeCell(&cell, &bakedCells);
+                }
+            }
             _AllocCell(&cell);
             vec2 v = vec2(cell.Quad.p.x, cell.Quad.p.z);
             float d = length(v) * GrowthRate;
@@ -621,6 +708,19 @@ void GridCity::Init()
             }
         }
     }
+    if (BakeCity) {
+        Blob blob(sizeof(header));
+        memcpy(&blob[0], &header, sizeof(header));
+        _ridges.Shape->WriteBinary(&blob);
+        blob.insert(blob.end(), bakedCells.begin(), bakedCells.end());
+        WriteBinaryFile(BakedCityFile, blob);
+    }
+    _ridges.CpuTriangles = new sketch::Tessellator(*_ridges.Shape);
+    _ridges.CpuTriangles->EnableParallel(true);
+    _ridges.CpuTriangles->EnableCacheOptimization(true);
+    if (pingpong && _ridges.Shape) {
+        _ridges.Shape->TakeSnapshot(&_ridges.Hidden);
+    }
 
     // Test the terrain sampling function
     bool TestGetHeight = false;
@@ -643,7 +743,12 @@ void GridCity::Init()
     // Compile shaders
     Programs& progs = Programs::GetInstance();
     progs.Load("Buildings.Terrain", false);
-    progs.Load("Sketch.Facets", true);
+    if (sketch::Tessellator::DefaultFacets || (centerpiece && BakedCenterpiece)) {
+        progs.Load("Sketch.Flat", "Sketch.Facets.FS", "Sketch.Flat.VS");
+    }
+    if (!sketch::Tessellator::DefaultFacets) {
+        progs.Load("Sketch.Facets", true);
+    }
     progs.Load("FireFlies.Sig", "FireFlies.Sig.FS", "FireFlies.Tube.VS");
 
     // Set up camera
@@ -698,7 +803,7 @@ sketch::PathList GridCity::_AddWindows(
     return windows;
 }
 
-void GridCity::_AllocCell(GridCell* cell)
+void GridCity::_BuildCell(GridCell* cell)
 {
     cell->Ridges[0] = 0;
     cell->Ridges[1] = 0;
@@ -706,6 +811,7 @@ void GridCity::_AllocCell(GridCell* cell)
     cell->Ridges[3] = 0;
 
     sketch::Scene* shape = new sketch::Scene;
+    cell->Shape = shape;
     cell->Roof.Path = shape->AddQuad(cell->Quad);
     vec3 n = cell->Roof.Path->Plane->GetNormal();
     float flip = dot(n, vec3(0, 1, 0)) < 0 ? -1 : 1;
@@ -719,7 +825,7 @@ void GridCity::_AllocCell(GridCell* cell)
     // Create window holes
     if (HasWindows) {
         FOR_EACH(w, walls) {
-            sketch::CoplanarPath* cop = dynamic_cast<sketch::CoplanarPath*>(*w);
+            sketch::CoplanarPath* cop = sketch::AsCoplanar(*w);
             _AddWindows(cell, cop);
         }
     }
@@ -745,7 +851,7 @@ void GridCity::_AllocCell(GridCell* cell)
             _ridges.Shape->PushPath(northRidge, ridgeHeight);
             anim->EndW = northRidge->Plane->Eqn.w;
             _ridges.Shape->SetPathPlane(northRidge, anim->BeginW);
-            northRidge->Visible = false;
+            _ridges.Shape->SetVisible(northRidge, false);
             anim->Path = northRidge;
             _ridges.Anims.push_back(anim);
             cell->Ridges[0] = anim;
@@ -763,7 +869,7 @@ void GridCity::_AllocCell(GridCell* cell)
             _ridges.Shape->PushPath(southRidge, ridgeHeight);
             anim->EndW = southRidge->Plane->Eqn.w;
             _ridges.Shape->SetPathPlane(southRidge, anim->BeginW);
-            southRidge->Visible = false;
+            _ridges.Shape->SetVisible(southRidge, false);
             anim->Path = southRidge;
             _ridges.Anims.push_back(anim);
             cell->Ridges[1] = anim;
@@ -781,7 +887,7 @@ void GridCity::_AllocCell(GridCell* cell)
             _ridges.Shape->PushPath(westRidge, ridgeHeight);
             anim->EndW = westRidge->Plane->Eqn.w;
             _ridges.Shape->SetPathPlane(westRidge, anim->BeginW);
-            westRidge->Visible = false;
+            _ridges.Shape->SetVisible(westRidge, false);
             anim->Path = westRidge;
             _ridges.Anims.push_back(anim);
             cell->Ridges[2] = anim;
@@ -799,20 +905,127 @@ void GridCity::_AllocCell(GridCell* cell)
             _ridges.Shape->PushPath(eastRidge, ridgeHeight);
             anim->EndW = eastRidge->Plane->Eqn.w;
             _ridges.Shape->SetPathPlane(eastRidge, anim->BeginW);
-            eastRidge->Visible = false;
+            _ridges.Shape->SetVisible(eastRidge, false);
             anim->Path = eastRidge;
             _ridges.Anims.push_back(anim);
             cell->Ridges[3] = anim;
         }
     }
+}
+
+// Saves the final form of a freshly built cell, along with its handles.
+void GridCity::_BakeCell(const GridCell* cell, Blob* dest)
+{
+    BakedCell baked;
+    baked.Roof = cell->Roof.Path->Index;
+    baked.BeginW = cell->Roof.BeginW;
+    baked.EndW = cell->Roof.EndW;
+    for (int i = 0; i < 4; ++i) {
+        GridAnim* ridge = cell->Ridges[i];
+        baked.Ridges[i] = ridge ? ridge->Path->Index : NoRidge;
+        baked.RidgeBeginW[i] = ridge ? ridge->BeginW : 0;
+        baked.RidgeEndW[i] = ridge ? ridge->EndW : 0;
+    }
+    const unsigned char* bytes = (const unsigned char*) &baked;
+    dest->insert(dest->end(), bytes, bytes + sizeof(baked));
+    cell->Shape->WriteBinary(dest);
+}
+
+// Counterpart to _BakeCell; the ridges must already be loaded.  Returns
+// zero, leaving the cell alone, if the image is damaged.
+size_t GridCity::_LoadCell(GridCell* cell, const Blob& src, size_t offset)
+{
+    if (offset + sizeof(BakedCell) > src.size()) {
+        return 0;
+    }
+    BakedCell baked;
+    memcpy(&baked, &src[offset], sizeof(baked));
+    offset += sizeof(baked);
+
+    // Every handle has to name a coplanar path
+    sketch::Scene* shape = new sketch::Scene;
+    offset = shape->ReadBinary(src, offset);
+    bool valid = offset &&
+        baked.Roof < shape->GetPathCount() &&
+        sketch::AsCoplanar(shape->GetPath(baked.Roof));
+    for (int i = 0; valid && i < 4; ++i) {
+        unsigned int ridge = baked.Ridges[i];
+        valid = ridge == NoRidge || (ridge < _ridges.Shape->GetPathCount() &&
+            sketch::AsCoplanar(_ridges.Shape->GetPath(ridge)));
+    }
+    if (!valid) {
+        delete shape;
+        return 0;
+    }
+
+    cell->Shape = shape;
+    cell->Roof.Path = sketch::AsCoplanar(shape->GetPath(baked.Roof));
+    cell->Roof.BeginW = baked.BeginW;
+    cell->Roof.EndW = baked.EndW;
+    for (int i = 0; i < 4; ++i) {
+        cell->Ridges[i] = 0;
+        if (baked.Ridges[i] == NoRidge) {
+            continue;
+        }
+        GridAnim* anim = new GridAnim();
+        anim->Path = sketch::AsCoplanar(_ridges.Shape->GetPath(baked.Ridges[i]));
+        anim->BeginW = baked.RidgeBeginW[i];
+        anim->EndW = baked.RidgeEndW[i];
+        _ridges.Anims.push_back(anim);
+        cell->Ridges[i] = anim;
+    }
+    return offset;
+}
+
+// Loads the ridges and every cell from a baked city.  Returns false, leaving
+// the ridges empty and every cell unbuilt, if any part of it is damaged.
+bool GridCity::_LoadCity(const Blob& src, size_t offset)
+{
+    offset = _ridges.Shape->ReadBinary(src, offset);
+    size_t loaded = 0;
+    while (offset && loaded < _cells.size()) {
+        offset = _LoadCell(&_cells[loaded], src, offset);
+        if (offset) {
+            ++loaded;
+        }
+    }
+    if (offset == src.size()) {
+        return true;
+    }
+
+    for (size_t i = 0; i < loaded; ++i) {
+        delete _cells[i].Shape;
+        _cells[i].Shape = 0;
+        for (int r = 0; r < 4; ++r) {
+            _cells[i].Ridges[r] = 0;
+        }
+    }
+    FOR_EACH(anim, _ridges.Anims) {
+        delete *anim;
+    }
+    _ridges.Anims.clear();
+    delete _ridges.Shape;
+    _ridges.Shape = new sketch::Scene();
+    return false;
+}
+
+// Tessellates the final form of the cell, then sinks it into the ground.
+void GridCity::_AllocCell(GridCell* cell)
+{
+    sketch::Scene* shape = cell->Shape;
 
     // Finalize the topology
     cell->CpuTriangles = new sketch::Tessellator(*shape);
+    cell->CpuTriangles->EnableParallel(true);
     cell->CpuTriangles->PullFromScene();
 
     // Push the building back into the ground to allow it to pop up later
     if (PopBuildings) {
-        shape->SetPathPlane(cell->Roof.Path, cell->Roof.BeginW);
+        shape->RigExtrusion(cell->Roof.Path, &cell->Roof.Rig);
+        shape->SetRigPlane(cell->Roof.Rig, cell->Roof.BeginW);
+        if (pingpong) {
+            shape->TakeSnapshot(&cell->Sunken);
+        }
     }
 
     // Test
@@ -833,10 +1046,10 @@ void GridCity::_AllocCell(GridCell* cell)
 
     // Misc
     cell->Roof.StartTime = 0;
-    cell->Shape = shape;
     cell->Visible = not PopBuildings;
     cell->CpuTriangles->PullFromScene();
-    cell->CpuTriangles->PushToGpu(cell->GpuTriangles);
+    cell->GpuTriangles = _cellPool.Alloc(0, 0, cell->BuildingId);
+    cell->CpuTriangles->PushToGpu(_cellPool, cell->GpuTriangles);
 
     if (not PopBuildings) {
         _FreeCell(cell);
@@ -849,6 +1062,28 @@ void GridCity::_FreeCell(GridCell* cell)
     delete cell->CpuTriangles;
     cell->Shape = 0;
     cell->CpuTriangles = 0;
+    cell->Sunken = sketch::SceneSnapshot();
+}
+
+// Sink every building back into the ground and grow the city again.
+// Only the points that the pop animations moved need to be restored.
+void GridCity::_Rewind()
+{
+    FOR_EACH(i, _cells) {
+        GridCell& cell = *i;
+        if (!cell.Shape) {
+            continue;
+        }
+        cell.Shape->RestoreSnapshot(cell.Sunken);
+        cell.CpuTriangles->PullFromScene();
+        cell.CpuTriangles->PushToGpu(_cellPool, cell.GpuTriangles);
+        cell.Roof.StartTime = 0;
+        cell.Visible = false;
+    }
+    if (_ridges.Shape) {
+        _ridges.Shape->RestoreSnapshot(_ridges.Hidden);
+    }
+    _currentBeat = 0;
 }
 
 void GridCity::Update()
@@ -859,6 +1094,7 @@ void GridCity::Update()
     }
 
     int numAnimating = 0;
+    int numUnborn = 0;
     tween::Elastic tweener;
     FOR_EACH(i, _cells) {
         GridCell& cell = *i;
@@ -869,6 +1105,7 @@ void GridCity::Update()
             // Check if the building hasn't been born yet:
             if (cell.Roof.StartBeat > _currentBeat) {
                 cell.Visible = false;
+                numUnborn++;
                 continue;
             }
             // At this point we're starting a new pop animation
@@ -877,9 +1114,9 @@ void GridCity::Update()
         }
         if (time > cell.Roof.StartTime + PopDuration) {
             // At this point we're ending a pop animation
-            cell.Shape->SetPathPlane(cell.Roof.Path, cell.Roof.EndW);
+            cell.Shape->SetRigPlane(cell.Roof.Rig, cell.Roof.EndW);
             cell.CpuTriangles->PullFromScene();
-            cell.CpuTriangles->PushToGpu(cell.GpuTriangles);
+            cell.CpuTriangles->PushToGpu(_cellPool, cell.GpuTriangles);
 
             // Show ridges
             for (int i = 0; i < 4; ++i) {
@@ -904,13 +1141,13 @@ void GridCity::Update()
             cell.Roof.BeginW,
             cell.Roof.EndW - cell.Roof.BeginW,
             PopDuration);
-        cell.Shape->SetPathPlane(cell.Roof.Path, w);
+        cell.Shape->SetRigPlane(cell.Roof.Rig, w);
         cell.CpuTriangles->PullFromScene();
-        cell.CpuTriangles->PushToGpu(cell.GpuTriangles);
+        cell.CpuTriangles->PushToGpu(_cellPool, cell.GpuTriangles);
     }
 
-    if (numAnimating == 0 && pingpong) {
-        // TBD prideout
+    if (numAnimating == 0 && numUnborn == 0 && pingpong) {
+        _Rewind();
     }
 
     // update vines
@@ -936,8 +1173,12 @@ void GridCity::Update()
                 _previousBump = time;
             }
         }
-        _centerpiecePlayer->Update(true, bump);
-        _centerpieceTess->PullFromScene();
+        if (BakedCenterpiece) {
+            _centerpieceBake->Update(true, bump);
+        } else {
+            _centerpiecePlayer->Update(true, bump);
+            _centerpieceTess->PullFromScene();
+        }
 
         if (false && time > 4.0f) {
             static bool cw = false;
@@ -976,38 +1217,45 @@ void GridCity::Draw()
 
     // Draw buildings
     glCullFace(GL_FRONT);
-    glUseProgram(progs["Sketch.Facets"]);
+    glUseProgram(progs[sketch::Tessellator::DefaultFacets ? "Sketch.Flat" : "Sketch.Facets"]);
     glUniform3f(u("Scale"), 1, 1, 1);
     glUniform3f(u("Translate"), 0, 0, 0);
     glUniform1i(u("HasWindows"), 1);
     _camera.Bind(glm::mat4());
 
+    // Every cell lives in the same pool, and gets its BuildingId from
+    // a vertex attribute, so they can all be drawn at once.
+    _visibleCells.clear();
     FOR_EACH(cell, _cells) {
-        glUniform1i(u("BuildingId"), cell->BuildingId);
-        if (not cell->Visible) {
-            continue;
+        if (cell->Visible) {
+            _visibleCells.push_back(cell->GpuTriangles);
         }
-        cell->GpuTriangles.Bind();
-        glDrawElements(GL_TRIANGLES, cell->GpuTriangles.indexCount, GL_UNSIGNED_INT, 0);
     }
+    _cellPool.Draw(_visibleCells);
 
     // Draw roof ridges
     glUniform1i(u("HasWindows"), 0);
-    glUniform1i(u("BuildingId"), 0);
     _ridges.GpuTriangles.Bind();
-    glDrawElements(GL_TRIANGLES, _ridges.GpuTriangles.indexCount, GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, _ridges.GpuTriangles.indexCount, _ridges.GpuTriangles.indexType, 0);
 
     // Add city wall
     glUniform1i(u("HasWindows"), 0);
     _cityWall.Bind();
-    glDrawElements(GL_TRIANGLES, _cityWall.indexCount, GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, _cityWall.indexCount, _cityWall.indexType, 0);
 
     // Draw the centerpiece
     if (centerpiece) {
         glDisable(GL_CULL_FACE);
-        _centerpieceTess->PushToGpu(_centerpieceVao);
-        _centerpieceVao.Bind();
-        glDrawElements(GL_TRIANGLES, _centerpieceVao.indexCount, GL_UNSIGNED_INT, 0);
+        if (BakedCenterpiece) {
+            glUseProgram(progs["Sketch.Flat"]);
+            glUniform1i(u("HasWindows"), 0);
+            _camera.Bind(glm::mat4());
+            _centerpieceBake->Draw();
+        } else {
+            _centerpieceTess->PushToGpu(_centerpieceVao);
+            _centerpieceVao.Bind();
+            glDrawElements(GL_TRIANGLES, _centerpieceVao.indexCount, _centerpieceVao.indexType, 0);
+        }
     }
 
     // Restore culling to normal
@@ -1119,12 +1367,12 @@ void GridCity::_CreateCenterpiece()
 
     for (int repeats = 0; repeats < 5; ++repeats) {
         for (int i = 0; i < numDents;) {
-            sketch::CoplanarPath* cop = dynamic_cast<sketch::CoplanarPath*>(dents[i]);
+            sketch::CoplanarPath* cop = sketch::AsCoplanar(dents[i]);
             _centerpieceSketch->PushPath(cop, 6);
             i += (repeats + 1);
         }
         for (int i = 0; i < numDents;) {
-            sketch::CoplanarPath* cop = dynamic_cast<sketch::CoplanarPath*>(dents[i]);
+            sketch::CoplanarPath* cop = sketch::AsCoplanar(dents[i]);
             _centerpieceSketch->PushPath(cop, -6);
             i += (repeats + 1);
         }
@@ -1134,10 +1382,17 @@ void GridCity::_CreateCenterpiece()
     std::swap(_historicalSketch, _centerpieceSketch);
 
     _centerpieceTess = new Tessellator(*_centerpieceSketch);
+    _centerpieceTess->EnableFacets(Tessellator::DefaultFacets || BakedCenterpiece);
     _centerpiecePlayer = new Playback(history, _centerpieceSketch, _centerpieceTess);
     _centerpieceSketch->EnableHistory(false);
     _historicalSketch->EnableHistory(false);
 
+    if (BakedCenterpiece) {
+        _centerpieceBake = new BakedPlayback(_centerpiecePlayer,
+                                             _centerpieceTess,
+                                             CenterpieceBakeSteps);
+    }
+
     _centerpieceTess->PullFromScene();
 }
 
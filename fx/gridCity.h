@@ -1,9 +1,11 @@
 #pragma once
 
 #include "common/effect.h"
+#include "common/sketchBake.h"
 #include "common/sketchPlayback.h"
 #include "common/sketchScene.h"
 #include "common/vao.h"
+#include "common/geometryPool.h"
 #include "common/camera.h"
 #include "common/halfBeat.h"
 #include "common/tube.h"
@@ -15,6 +17,7 @@ struct GridAnim {
     float StartTime;
     int StartBeat;
     sketch::CoplanarPath* Path;
+    sketch::ExtrusionRig Rig;
 };
 
 struct GridCell {
@@ -22,8 +25,9 @@ struct GridCell {
     float Height;
     sketch::Scene* Shape;
     sketch::Tessellator* CpuTriangles;
+    sketch::SceneSnapshot Sunken;
     GridAnim Roof;
-    Vao GpuTriangles;
+    GeometryPool::Handle GpuTriangles;
     bool Visible;
     int BuildingId;
     GridAnim* Ridges[4];
@@ -36,6 +40,7 @@ struct GridRidges {
     GridAnims Anims;
     sketch::Scene* Shape;
     sketch::Tessellator* CpuTriangles;
+    sketch::SceneSnapshot Hidden;
     Vao GpuTriangles;
 };
 
@@ -58,8 +63,13 @@ public:
 
 private:
     vec2 _CellSample(int row, int col);
+    void _BuildCell(GridCell* cell);
+    void _BakeCell(const GridCell* cell, Blob* dest);
+    size_t _LoadCell(GridCell* cell, const Blob& src, size_t offset);
+    bool _LoadCity(const Blob& src, size_t offset);
     void _AllocCell(GridCell* cell);
     void _FreeCell(GridCell* cell);
+    void _Rewind();
     Vao _CreateCityWall();
     void _CreateVines();
     Tube* _CreateVine(float xmix, float zmix, float dirFactor, bool facingX,
@@ -75,6 +85,8 @@ private:
 
     HalfBeat _beats;
     GridCells _cells;
+    GeometryPool _cellPool;
+    std::vector<GeometryPool::Handle> _visibleCells;
     Vao _terrainVao;
     PerspCamera _camera;
     int _currentBeat;
@@ -86,6 +98,7 @@ private:
     sketch::Scene* _historicalSketch;
     sketch::Tessellator* _centerpieceTess;
     sketch::Playback* _centerpiecePlayer;
+    sketch::BakedPlayback* _centerpieceBake;
     sketch::PathList _columns;
     sketch::PathList _hangingThings;
     vec3 _columnCenter;
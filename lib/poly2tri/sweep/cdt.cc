@@ -32,17 +32,28 @@
 
 namespace p2t {
 
-CDT::CDT(std::vector<Point*> polyline)
+CDT::CDT(const std::vector<Point*>& polyline)
 {
   sweep_context_ = new SweepContext(polyline);
   sweep_ = new Sweep;
 }
 
-void CDT::AddHole(std::vector<Point*> polyline)
+CDT::CDT()
+{
+  sweep_context_ = new SweepContext;
+  sweep_ = new Sweep;
+}
+
+void CDT::AddHole(const std::vector<Point*>& polyline)
 {
   sweep_context_->AddHole(polyline);
 }
 
+void CDT::Reset(const std::vector<Point*>& polyline)
+{
+  sweep_context_->Reset(polyline);
+}
+
 void CDT::AddPoint(Point* point) {
   sweep_context_->AddPoint(point);
 }
@@ -52,7 +63,7 @@ void CDT::Triangulate()
   sweep_->Triangulate(*sweep_context_);
 }
 
-std::vector<p2t::Triangle*> CDT::GetTriangles()
+const std::vector<p2t::Triangle*>& CDT::GetTriangles()
 {
   return sweep_context_->GetTriangles();
 }
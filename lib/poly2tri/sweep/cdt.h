@@ -53,7 +53,12 @@ public:
    * 
    * @param polyline
    */
-  CDT(std::vector<Point*> polyline);
+  CDT(const std::vector<Point*>& polyline);
+
+  /**
+   * Constructor - empty triangulation, call Reset before use
+   */
+  CDT();
   
    /**
    * Destructor - clean up memory
@@ -65,7 +70,15 @@ public:
    * 
    * @param polyline
    */
-  void AddHole(std::vector<Point*> polyline);
+  void AddHole(const std::vector<Point*>& polyline);
+
+  /**
+   * Start over with a new polyline, recycling the memory of the previous
+   * triangulation.  Triangles returned earlier become invalid.
+   *
+   * @param polyline
+   */
+  void Reset(const std::vector<Point*>& polyline);
   
   /**
    * Add a steiner point
@@ -82,7 +95,7 @@ public:
   /**
    * Get CDT triangles
    */
-  std::vector<Triangle*> GetTriangles();
+  const std::vector<Triangle*>& GetTriangles();
   
   /**
    * Get triangle map
@@ -30,21 +30,71 @@
  */
 #include "sweep_context.h"
 #include <algorithm>
+#include <new>
 #include "advancing_front.h"
 
 namespace p2t {
 
-SweepContext::SweepContext(std::vector<Point*> polyline)
+SweepContext::SweepContext(const std::vector<Point*>& polyline)
+  : triangles_used_(0), nodes_used_(0), edges_used_(0), front_(NULL)
+{
+  head_ = new Point;
+  tail_ = new Point;
+  af_head_ = af_middle_ = af_tail_ = NULL;
+  Reset(polyline);
+}
+
+SweepContext::SweepContext()
+  : triangles_used_(0), nodes_used_(0), edges_used_(0), front_(NULL)
+{
+  head_ = new Point;
+  tail_ = new Point;
+  af_head_ = af_middle_ = af_tail_ = NULL;
+}
+
+void SweepContext::Reset(const std::vector<Point*>& polyline)
 {
   basin = Basin();
   edge_event = EdgeEvent();
 
-  points_ = polyline;
+  triangles_.clear();
+  map_.clear();
+  edge_list.clear();
+  triangles_used_ = nodes_used_ = edges_used_ = 0;
+
+  points_.assign(polyline.begin(), polyline.end());
 
   InitEdges(points_);
 }
 
-void SweepContext::AddHole(std::vector<Point*> polyline)
+Triangle* SweepContext::NewTriangle(Point& a, Point& b, Point& c)
+{
+  if (triangles_used_ == triangle_pool_.size()) {
+    triangle_pool_.push_back(new Triangle(a, b, c));
+    return triangle_pool_[triangles_used_++];
+  }
+  return new (triangle_pool_[triangles_used_++]) Triangle(a, b, c);
+}
+
+Node* SweepContext::NewNode(Point& p)
+{
+  if (nodes_used_ == node_pool_.size()) {
+    node_pool_.push_back(new Node(p));
+    return node_pool_[nodes_used_++];
+  }
+  return new (node_pool_[nodes_used_++]) Node(p);
+}
+
+Node* SweepContext::NewNode(Point& p, Triangle& t)
+{
+  if (nodes_used_ == node_pool_.size()) {
+    node_pool_.push_back(new Node(p, t));
+    return node_pool_[nodes_used_++];
+  }
+  return new (node_pool_[nodes_used_++]) Node(p, t);
+}
+
+void SweepContext::AddHole(const std::vector<Point*>& polyline)
 {
   InitEdges(polyline);
   for(unsigned int i = 0; i < polyline.size(); i++) {
@@ -56,14 +106,14 @@ void SweepContext::AddPoint(Point* point) {
   points_.push_back(point);
 }
 
-std::vector<Triangle*> SweepContext::GetTriangles()
+const std::vector<Triangle*>& SweepContext::GetTriangles()
 {
   return triangles_;
 }
 
 std::list<Triangle*> SweepContext::GetMap()
 {
-  return map_;
+  return std::list<Triangle*>(map_.begin(), map_.end());
 }
 
 void SweepContext::InitTriangulation()
@@ -86,20 +136,27 @@ void SweepContext::InitTriangulation()
 
   double dx = kAlpha * (xmax - xmin);
   double dy = kAlpha * (ymax - ymin);
-  head_ = new Point(xmax + dx, ymin - dy);
-  tail_ = new Point(xmin - dx, ymin - dy);
+  head_->set(xmax + dx, ymin - dy);
+  tail_->set(xmin - dx, ymin - dy);
 
   // Sort points along y-axis
   std::sort(points_.begin(), points_.end(), cmp);
 
 }
 
-void SweepContext::InitEdges(std::vector<Point*> polyline)
+void SweepContext::InitEdges(const std::vector<Point*>& polyline)
 {
   int num_points = polyline.size();
   for (int i = 0; i < num_points; i++) {
     int j = i < num_points - 1 ? i + 1 : 0;
-    edge_list.push_back(new Edge(*polyline[i], *polyline[j]));
+    Point& p = *polyline[i];
+    Point& q = *polyline[j];
+    if (edges_used_ == edge_pool_.size()) {
+      edge_pool_.push_back(new Edge(p, q));
+      edge_list.push_back(edge_pool_[edges_used_++]);
+    } else {
+      edge_list.push_back(new (edge_pool_[edges_used_++]) Edge(p, q));
+    }
   }
 }
 
@@ -119,19 +176,22 @@ Node& SweepContext::LocateNode(Point& point)
   return *front_->LocateNode(point.x);
 }
 
-void SweepContext::CreateAdvancingFront(std::vector<Node*> nodes)
+void SweepContext::CreateAdvancingFront()
 {
 
-  (void) nodes;
   // Initial triangle
-  Triangle* triangle = new Triangle(*points_[0], *tail_, *head_);
+  Triangle* triangle = NewTriangle(*points_[0], *tail_, *head_);
 
   map_.push_back(triangle);
 
-  af_head_ = new Node(*triangle->GetPoint(1), *triangle);
-  af_middle_ = new Node(*triangle->GetPoint(0), *triangle);
-  af_tail_ = new Node(*triangle->GetPoint(2));
-  front_ = new AdvancingFront(*af_head_, *af_tail_);
+  af_head_ = NewNode(*triangle->GetPoint(1), *triangle);
+  af_middle_ = NewNode(*triangle->GetPoint(0), *triangle);
+  af_tail_ = NewNode(*triangle->GetPoint(2));
+  if (front_) {
+    *front_ = AdvancingFront(*af_head_, *af_tail_);
+  } else {
+    front_ = new AdvancingFront(*af_head_, *af_tail_);
+  }
 
   // TODO: More intuitive if head is middles next and not previous?
   //       so swap head and tail
@@ -143,7 +203,8 @@ void SweepContext::CreateAdvancingFront(std::vector<Node*> nodes)
 
 void SweepContext::RemoveNode(Node* node)
 {
-  delete node;
+  // Nodes stay in the pool until the context is destroyed
+  (void) node;
 }
 
 void SweepContext::MapTriangleToNodes(Triangle& t)
@@ -159,7 +220,7 @@ void SweepContext::MapTriangleToNodes(Triangle& t)
 
 void SweepContext::RemoveFromMap(Triangle* triangle)
 {
-  map_.remove(triangle);
+  map_.erase(std::remove(map_.begin(), map_.end(), triangle), map_.end());
 }
 
 void SweepContext::MeshClean(Triangle& triangle)
@@ -182,19 +243,17 @@ SweepContext::~SweepContext()
     delete head_;
     delete tail_;
     delete front_;
-    delete af_head_;
-    delete af_middle_;
-    delete af_tail_;
 
-    typedef std::list<Triangle*> type_list;
+    for(size_t i = 0; i < triangle_pool_.size(); i++) {
+        delete triangle_pool_[i];
+    }
 
-    for(type_list::iterator iter = map_.begin(); iter != map_.end(); ++iter) {
-        Triangle* ptr = *iter;
-        delete ptr;
+    for(size_t i = 0; i < node_pool_.size(); i++) {
+        delete node_pool_[i];
     }
 
-     for(unsigned int i = 0; i < edge_list.size(); i++) {
-        delete edge_list[i];
+    for(size_t i = 0; i < edge_pool_.size(); i++) {
+        delete edge_pool_[i];
     }
 
 }
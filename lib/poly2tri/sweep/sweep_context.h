@@ -52,7 +52,9 @@ class SweepContext {
 public:
 
 /// Constructor
-SweepContext(std::vector<Point*> polyline);
+SweepContext(const std::vector<Point*>& polyline);
+/// Constructor for an empty context, call Reset before use
+SweepContext();
 /// Destructor
 ~SweepContext();
 
@@ -70,7 +72,17 @@ Node& LocateNode(Point& point);
 
 void RemoveNode(Node* node);
 
-void CreateAdvancingFront(std::vector<Node*> nodes);
+void CreateAdvancingFront();
+
+/// Start over with a new polyline.  Triangles, nodes and edges of the
+/// previous triangulation are kept around and handed out again by the
+/// New* methods below.  The points of the new polyline must have empty
+/// edge lists.
+void Reset(const std::vector<Point*>& polyline);
+
+Triangle* NewTriangle(Point& a, Point& b, Point& c);
+Node* NewNode(Point& p);
+Node* NewNode(Point& p, Triangle& t);
 
 /// Try to map a node to all sides of this triangle that don't have a neighbor
 void MapTriangleToNodes(Triangle& t);
@@ -83,7 +95,7 @@ Point* GetPoints();
 
 void RemoveFromMap(Triangle* triangle);
 
-void AddHole(std::vector<Point*> polyline);
+void AddHole(const std::vector<Point*>& polyline);
 
 void AddPoint(Point* point);
 
@@ -91,7 +103,7 @@ AdvancingFront* front();
 
 void MeshClean(Triangle& triangle);
 
-std::vector<Triangle*> GetTriangles();
+const std::vector<Triangle*>& GetTriangles();
 std::list<Triangle*> GetMap();
 
 std::vector<Edge*> edge_list;
@@ -134,9 +146,16 @@ private:
 friend class Sweep;
 
 std::vector<Triangle*> triangles_;
-std::list<Triangle*> map_;
+std::vector<Triangle*> map_;
 std::vector<Point*> points_;
 
+// Every triangle, node and edge ever allocated by this context; the first
+// *_used_ entries of each pool belong to the current triangulation
+std::vector<Triangle*> triangle_pool_;
+std::vector<Node*> node_pool_;
+std::vector<Edge*> edge_pool_;
+size_t triangles_used_, nodes_used_, edges_used_;
+
 // Advancing front
 AdvancingFront* front_;
 // head point used with advancing front
@@ -147,7 +166,7 @@ Point* tail_;
 Node *af_head_, *af_middle_, *af_tail_;
 
 void InitTriangulation();
-void InitEdges(std::vector<Point*> polyline);
+void InitEdges(const std::vector<Point*>& polyline);
 
 };
 
@@ -440,6 +440,8 @@ void PezRender()
 
 void PezUpdate(float seconds)
 {
+    Vao::NextFrame();
+
     // sync up the audio sequencer
     Audio::Get().Update(seconds);
 
@@ -2,18 +2,41 @@
 solution "Salad"
    configurations { "Debug", "Release" }
  
+   -- The C libraries get a project of their own, since premake applies
+   -- buildoptions to every file of a project regardless of its language
+   project "SaladC"
+      kind "StaticLib"
+      language "C"
+      buildoptions { "-Wall", "-std=c99", "-Wc++-compat", "-O3" }
+
+      includedirs { "../lib", "../" }
+
+      files { 
+              "../lib/pez/**.h", 
+              "../lib/pez/**.c", 
+              "../lib/lodepng/**.h", 
+              "../lib/lodepng/**.c" }
+ 
+      configuration "Debug"
+         defines { "DEBUG" }
+         flags { "Symbols" }
+ 
+      configuration "Release"
+         defines { "NDEBUG" }
+         flags { "Optimize" }    
+
    -- A project defines one build target
    project "Salad"
       kind "ConsoleApp"
       language "C++"
-      buildoptions { "-Wall", "-std=c99", "-Wc++-compat", "-O3" }
+      buildoptions { "-Wall", "-std=gnu++0x", "-O3" }
 
       includedirs { "../lib", "../" }
 
       linkoptions { "../lib/tetgen/libtet.a", 
                     "../lib/jsoncpp/libjson_linux-gcc-4.4.6_libmt.a",
                     }
-      links { "X11", "GL", "pthread" }
+      links { "SaladC", "X11", "GL", "pthread" }
 
       os.rmdir("shaders")
       os.rmdir("data")
@@ -36,10 +59,6 @@ solution "Salad"
               "../lib/noise/**.cpp", 
               "../lib/tthread/**.h", 
               "../lib/tthread/**.cpp", 
-              "../lib/pez/**.h", 
-              "../lib/pez/**.c", 
-              "../lib/lodepng/**.h", 
-              "../lib/lodepng/**.c", 
               "../common/**.h", 
               "../common/**.cpp", 
               "../fx/**.hh", 
@@ -1,6 +1,7 @@
 -- Facets.VS
 
 layout(location = 0) in vec4 Position;
+layout(location = 5) in float BuildingId;
 
 uniform mat4 Projection;
 uniform mat4 Modelview;
@@ -9,6 +10,7 @@ uniform vec3 Translate = vec3(0);
 uniform vec3 Scale = vec3(1);
 
 out vec3 vPosition;
+out float vBuildingId;
 
 //out vec3 gPosition;
 //out vec4 gColor;
@@ -19,6 +21,7 @@ void main()
     //gColor = vec4(1,1,1,1);
     //gPosition = gFacetNormal =
     vPosition = Position.xyz * Scale + Translate;
+    vBuildingId = BuildingId;
     gl_Position = Projection * Modelview * vec4(vPosition, 1);
 }
 
@@ -32,6 +35,7 @@ uniform mat4 Projection;
 uniform mat4 Modelview;
 
 in vec3 vPosition[3];
+in float vBuildingId[3];
 
 out vec4 gColor;
 out vec3 gFacetNormal;
@@ -46,7 +50,6 @@ uniform bool Smooth = false;
 
 const vec3 ByteScale = 1.0 / vec3(255.0);
 const float InverseMaxInt = 1.0 / 4294967295.0;
-uniform int BuildingId;
 
 float randhash(uint seed, float b)
 {
@@ -77,7 +80,7 @@ void main()
 
     //float p = vPosition[0].x + vPosition[0].y + vPosition[0].y;
     //float n = gFacetNormal.x + gFacetNormal.y + gFacetNormal.z;
-    uint seed = uint(BuildingId);
+    uint seed = uint(vBuildingId[0]);
     float sel = randhash(seed, 1.0);
     vec3 col = vec3(255.0) * sel;
 
@@ -122,6 +125,73 @@ void main()
     EndPrimitive();
 }
 
+-- Flat.VS
+
+// Stands in for Facets.VS and Facets.GS when the tessellator has already
+// split the triangles apart and computed their facet attributes.
+
+layout(location = 0) in vec4 Position;
+layout(location = 1) in vec3 Normal;
+layout(location = 2) in vec2 TexCoord;
+layout(location = 5) in float BuildingId;
+layout(location = 6) in vec3 Facet;
+
+uniform mat3 NormalMatrix;
+uniform mat4 Projection;
+uniform mat4 Modelview;
+
+uniform vec3 Translate = vec3(0);
+uniform vec3 Scale = vec3(1);
+
+out vec4 gColor;
+out vec3 gFacetNormal;
+out float gAltitude;
+out vec4 gePosition;
+out float gIsRoof;
+out vec2 gTexCoord;
+out float gRows;
+out float gCols;
+
+const vec3 ByteScale = 1.0 / vec3(255.0);
+const float InverseMaxInt = 1.0 / 4294967295.0;
+
+float randhash(uint seed, float b)
+{
+    uint i=(seed^12345391u)*2654435769u;
+    i^=(i<<6u)^(i>>26u);
+    i*=2654435769u;
+    i+=(i<<5u)^(i>>12u);
+    return float(b * i) * InverseMaxInt;
+}
+
+void main()
+{
+    uint seed = uint(BuildingId);
+    float sel = randhash(seed, 1.0);
+    vec3 col;
+
+    if (sel < 0.25) {
+        col = vec3(243, 210, 129);
+    } else if (sel < 0.5) {
+        col = vec3(243, 206, 164);
+    } else if (sel < 0.75) {
+        col = vec3(161, 110, 45);
+    } else {
+        col = vec3(249, 219, 169);
+    }
+
+    vec3 position = Position.xyz * Scale + Translate;
+    gColor = vec4(ByteScale * col, 1);
+    gFacetNormal = NormalMatrix * Normal;
+    gRows = Facet.x;
+    gCols = Facet.y;
+    gIsRoof = Facet.z;
+    gTexCoord = TexCoord;
+    gAltitude = position.y;
+    gePosition = Modelview * vec4(position, 1);
+    gl_Position = Projection * gePosition;
+}
+
 -- Facets.FS
 
 in vec4 gePosition;
@@ -0,0 +1,331 @@
+#include "lib/pez/pez.h"
+#include "common/init.h"
+#include "common/sketchScene.h"
+#include "common/sketchTess.h"
+#include "common/vao.h"
+#include "tween/CppTweener.h"
+#include "glm/glm.hpp"
+#include <sys/time.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+// Times the sketch library on synthetic scenes.  Every case runs once at
+// startup and prints its results, then the program quits.
+
+using namespace std;
+using glm::vec3;
+
+// Size of the window grid on the benchmark facade; 100x100 gives 10k windows.
+static const int FacadeRows = 100;
+static const int FacadeColumns = 100;
+
+// Size of the window grid for the animation benchmark, which is about as
+// many windows as a CityGrowth building has, and how many frames to run.
+static const int AnimatedRows = 14;
+static const int AnimatedColumns = 14;
+static const int AnimatedFrames = 1000;
+
+// Footprint and height of the building for the DETAIL benchmark, which is
+// about the size of a CityGrowth skyscraper, and how many frames to run.
+static const float DetailWidth = 14;
+static const float DetailHeight = 40;
+static const float DetailWindowThickness = 0.1f;
+static const float DetailSeconds = 4;
+static const int DetailFrames = 1000;
+
+// Paths that slide from BeginW to EndW, and their rigs; see CityGrowth.
+struct DetailAnims
+{
+    sketch::PathList Paths;
+    vector<sketch::ExtrusionRig> Rigs;
+    FloatList BeginW;
+    FloatList EndW;
+};
+
+static double
+_GetSeconds()
+{
+    struct timeval tp;
+    gettimeofday(&tp, NULL);
+    return tp.tv_sec + tp.tv_usec / 1000000.0;
+}
+
+// Punches a grid of unit windows into a wall, two units apart.  Each window
+// appends four points, so this is dominated by welding.
+static sketch::PathList
+_BuildFacade(sketch::Scene* scene)
+{
+    sketch::Quad wallQuad;
+    wallQuad.p = vec3(0, FacadeRows, 0);
+    wallQuad.u = vec3(FacadeColumns, 0, 0);
+    wallQuad.v = vec3(0, FacadeRows, 0);
+    sketch::CoplanarPath* wall = scene->AddQuad(wallQuad);
+
+    sketch::PathList windows;
+    for (int row = 0; row < FacadeRows; ++row) {
+        for (int col = 0; col < FacadeColumns; ++col) {
+            sketch::Quad holeQuad;
+            holeQuad.p = wallQuad.p + vec3(1 + 2 * col - FacadeColumns,
+                                           1 + 2 * row - FacadeRows, 0);
+            holeQuad.u = vec3(0.5f, 0, 0);
+            holeQuad.v = vec3(0, 0.5f, 0);
+            windows.push_back(scene->AddHoleQuad(holeQuad, wall));
+        }
+    }
+    return windows;
+}
+
+// Builds the facade with grid welding and then with the linear scan, and
+// checks that both produce the same scene.
+static void
+_BenchWelding()
+{
+    double seconds[2];
+    Blob images[2];
+    for (int linear = 0; linear < 2; ++linear) {
+        sketch::Scene::EnableLinearWelding(linear);
+        sketch::Scene scene;
+        scene.EnableHistory(false);
+        double start = _GetSeconds();
+        _BuildFacade(&scene);
+        seconds[linear] = _GetSeconds() - start;
+        scene.WriteBinary(&images[linear]);
+    }
+    sketch::Scene::EnableLinearWelding(false);
+
+    printf("Welding a %dx%d facade: grid %.3f s, linear %.3f s, %s\n",
+           FacadeColumns, FacadeRows, seconds[0], seconds[1],
+           images[0] == images[1] ? "identical" : "DIFFERENT");
+}
+
+// Inscribes a framed window into each cell of a wall and extrudes them the
+// way CityGrowth does: frames out from the wall, windows back into them.
+static void
+_BuildFramedWindows(sketch::Scene* scene,
+                    sketch::PathList* frames,
+                    sketch::PathList* windows)
+{
+    sketch::Quad wallQuad;
+    wallQuad.p = vec3(0, AnimatedRows, 0);
+    wallQuad.u = vec3(AnimatedColumns, 0, 0);
+    wallQuad.v = vec3(0, AnimatedRows, 0);
+    sketch::CoplanarPath* wall = scene->AddQuad(wallQuad);
+
+    for (int row = 0; row < AnimatedRows; ++row) {
+        for (int col = 0; col < AnimatedColumns; ++col) {
+            sketch::Quad frameQuad;
+            frameQuad.p = wallQuad.p + vec3(1 + 2 * col - AnimatedColumns,
+                                            1 + 2 * row - AnimatedRows, 0);
+            frameQuad.u = vec3(0.75f, 0, 0);
+            frameQuad.v = vec3(0, 0.75f, 0);
+            sketch::CoplanarPath* frame = scene->AddInscribedQuad(frameQuad, wall);
+            sketch::Quad windowQuad = frameQuad;
+            windowQuad.u = vec3(0.5f, 0, 0);
+            windowQuad.v = vec3(0, 0.5f, 0);
+            frames->push_back(frame);
+            windows->push_back(scene->AddInscribedQuad(windowQuad, frame));
+        }
+    }
+    scene->PushPaths(*frames, 0.2f);
+    scene->PushPaths(*windows, -0.1f);
+}
+
+// Target offset of the given path on the given frame; every path slides
+// back and forth with its own phase.
+static float
+_GetAnimatedW(float restW, size_t path, int frame)
+{
+    return restW + 0.1f * sin(0.01f * frame + 0.1f * path);
+}
+
+// Animates the frames and windows with a SetPathPlanes loop, and then with
+// SetRigPlanes on rigs captured up front, and checks that both end up with
+// the same scene.
+static void
+_BenchRigs()
+{
+    double seconds[2];
+    Blob images[2];
+    for (int rigged = 0; rigged < 2; ++rigged) {
+        sketch::Scene scene;
+        scene.EnableHistory(false);
+        sketch::PathList frames, windows;
+        _BuildFramedWindows(&scene, &frames, &windows);
+
+        sketch::PathList paths(frames);
+        paths.insert(paths.end(), windows.begin(), windows.end());
+        FloatList restW(paths.size());
+        vector<sketch::ExtrusionRig> rigs(paths.size());
+        for (size_t i = 0; i < paths.size(); ++i) {
+            sketch::CoplanarPath* cop = sketch::AsCoplanar(paths[i]);
+            restW[i] = cop->Plane->Eqn.w;
+            scene.RigExtrusion(cop, &rigs[i]);
+        }
+
+        FloatList ws(paths.size());
+        double start = _GetSeconds();
+        for (int frame = 0; frame < AnimatedFrames; ++frame) {
+            for (size_t i = 0; i < paths.size(); ++i) {
+                ws[i] = _GetAnimatedW(restW[i], i, frame);
+            }
+            if (rigged) {
+                scene.SetRigPlanes(&rigs[0], &ws[0], ws.size());
+            } else {
+                scene.SetPathPlanes(paths, ws);
+            }
+        }
+        seconds[rigged] = _GetSeconds() - start;
+        scene.WriteBinary(&images[rigged]);
+    }
+
+    printf("Animating %d frames and windows: SetPathPlanes %.3f ms, "
+           "SetRigPlanes %.3f ms per frame, %s\n",
+           AnimatedRows * AnimatedColumns * 2,
+           1000 * seconds[0] / AnimatedFrames,
+           1000 * seconds[1] / AnimatedFrames,
+           images[0] == images[1] ? "identical" : "DIFFERENT");
+}
+
+// Pushes the paths and records where they start and end up.
+static void
+_PushDetailPaths(sketch::Scene* scene, DetailAnims* anims, float delta)
+{
+    scene->PushPaths(anims->Paths, delta);
+    FOR_EACH(p, anims->Paths) {
+        anims->EndW.push_back(sketch::AsCoplanar(*p)->Plane->Eqn.w);
+    }
+    scene->PushPaths(anims->Paths, -delta);
+    anims->Rigs.resize(anims->Paths.size());
+    for (size_t i = 0; i < anims->Paths.size(); ++i) {
+        sketch::CoplanarPath* cop = sketch::AsCoplanar(anims->Paths[i]);
+        anims->BeginW.push_back(cop->Plane->Eqn.w);
+        scene->RigExtrusion(cop, &anims->Rigs[i]);
+    }
+}
+
+// Extrudes a box and lays out hidden, collapsed window frames and windows
+// on its walls, the way CityGrowth sets up a building for DETAIL.
+static void
+_BuildDetailBuilding(sketch::Scene* scene,
+                     DetailAnims* frames,
+                     DetailAnims* windows)
+{
+    sketch::CoplanarPath* roof = scene->AddRectangle(
+        DetailWidth, DetailWidth, scene->GroundPlane()->Eqn, glm::vec2(0));
+    sketch::PathList walls;
+    scene->PushPath(roof, DetailHeight, &walls);
+
+    FOR_EACH(w, walls) {
+        sketch::CoplanarPath* wall = sketch::AsCoplanar(*w);
+        glm::vec2 extent = scene->GetPathExtent(wall);
+        int numRows = std::max(1, int(extent.x / 4.0));
+        int numCols = std::max(1, int(extent.y / 3.0));
+        float cellHeight = (extent.x - (numRows + 1)) / float(numRows);
+        float cellWidth = (extent.y - (numCols + 1)) / float(numCols);
+        float orientation = (wall->Plane->GetCoordSys() * vec3(1, 0, 0)).y;
+        glm::vec2 offset;
+        offset.x = 1 + cellWidth / 2 - extent.y / 2;
+        for (int col = 0; col < numCols; ++col) {
+            offset.y = 1 + cellHeight / 2 - extent.x / 2;
+            for (int row = 0; row < numRows; ++row) {
+                sketch::CoplanarPath* frame = scene->AddInscribedRectangle(
+                    cellHeight, cellWidth, wall,
+                    orientation * glm::vec2(offset.y, offset.x));
+                sketch::CoplanarPath* window = scene->AddInscribedRectangle(
+                    cellHeight - 1, cellWidth - 1, frame, glm::vec2(0));
+                frames->Paths.push_back(frame);
+                windows->Paths.push_back(window);
+                offset.y += cellHeight + 1;
+            }
+            offset.x += cellWidth + 1;
+        }
+    }
+    scene->SetVisible(frames->Paths, false);
+    scene->SetVisible(windows->Paths, false);
+    _PushDetailPaths(scene, frames, DetailWindowThickness);
+    _PushDetailPaths(scene, windows, -DetailWindowThickness / 2);
+}
+
+static void
+_AnimateDetailPaths(sketch::Scene* scene, const DetailAnims& anims, float t)
+{
+    tween::Elastic tweener;
+    FloatList ws(anims.Rigs.size());
+    for (size_t i = 0; i < ws.size(); ++i) {
+        ws[i] = tweener.easeOut(t, anims.BeginW[i],
+                                anims.EndW[i] - anims.BeginW[i],
+                                DetailSeconds);
+    }
+    scene->SetRigPlanes(&anims.Rigs[0], &ws[0], ws.size());
+}
+
+// Runs the per-frame work of CityGrowth::_UpdateDetail on one building,
+// timing the scene and the tessellator separately.
+static void
+_BenchDetail()
+{
+    sketch::Scene scene;
+    scene.EnableHistory(false);
+    DetailAnims frames, windows;
+    _BuildDetailBuilding(&scene, &frames, &windows);
+    sketch::Tessellator tess(scene);
+    tess.EnableCacheOptimization(true);
+    Vao vao;
+    tess.PullFromScene();
+    tess.PushToGpu(vao);
+
+    double sceneSeconds = 0;
+    double tessSeconds = 0;
+    for (int frame = 0; frame < DetailFrames; ++frame) {
+        float t = DetailSeconds * frame / DetailFrames;
+        double start = _GetSeconds();
+        scene.SetVisible(frames.Paths, true);
+        scene.SetVisible(windows.Paths, true);
+        _AnimateDetailPaths(&scene, frames, t);
+        _AnimateDetailPaths(&scene, windows, t);
+        double middle = _GetSeconds();
+        tess.PullFromScene();
+        tess.PushToGpu(vao);
+        sceneSeconds += middle - start;
+        tessSeconds += _GetSeconds() - middle;
+    }
+
+    printf("Animating a DETAIL building with %d windows: scene %.3f ms, "
+           "tessellator %.3f ms per frame\n",
+           int(windows.Paths.size()),
+           1000 * sceneSeconds / DetailFrames,
+           1000 * tessSeconds / DetailFrames);
+}
+
+PezConfig PezGetConfig()
+{
+    PezConfig config;
+    config.Title = __FILE__;
+    config.Width = 256;
+    config.Height = 256;
+    config.Multisampling = false;
+    config.VerticalSync = false;
+    config.Fullscreen = false;
+    return config;
+}
+
+void PezInitialize()
+{
+    _BenchWelding();
+    _BenchRigs();
+    _BenchDetail();
+    exit(0);
+}
+
+void PezHandleMouse(int x, int y, int action)
+{
+}
+
+void PezRender()
+{
+}
+
+void PezUpdate(float seconds)
+{
+}